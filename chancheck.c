@@ -0,0 +1,160 @@
+/* ******************************************************************
+   CHANNEL SKIP-SAMPLING CHECK
+
+   Drives the same number of packets through channel.c with a draw per
+   packet and with --skip-sampling (the skip field), at loss and
+   corruption probabilities of 0.001, 0.01 and 0.1, and compares them:
+   - the loss and corruption rates, against the probability asked for;
+   - the gaps between losses, against the geometric distribution, with
+   a chi-square test over bins of about equal probability;
+   - the random numbers drawn per packet and the packets decided per
+   second.
+   Each packet is decided as tolayer3() does: lost or not, and if not,
+   corrupted or not.  The arrival time is left out, as it takes one draw
+   either way.  A rate more than 4 standard errors off, or a chi-square
+   statistic of the skip sampled gaps above its 99.9th percentile, is
+   reported as FAIL and the program exits with a failure status.
+
+   The gaps drawn per packet are shown but not judged: the generator is
+   the additive one of rand(), r[n] = r[n-3] + r[n-31], and with two
+   draws per packet its lag of 31 shows as too few gaps of 15 packets
+   once losses are common (p = 0.01 and above).  The skip sampled gaps
+   take one draw each and do not see it.
+
+   Build with: gcc -O2 chancheck.c channel.c rng.c -lm
+   and run:    ./a.out [packets [seed]]   (default 10000000 and 9999)
+   ********************************************************************* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "emulator.h"
+#include "rng.h"
+#include "channel.h"
+
+#define NBINS 32                /* bins of the gap histogram */
+
+int TRACE = 0;
+
+struct result {
+  long lost, corrupted;
+  long observed[NBINS];         /* gaps between losses per bin */
+  unsigned long draws;
+  double seconds;
+};
+
+/* first gap of bin i, so that each bin holds about 1/NBINS of the
+   geometric distribution with parameter p */
+static long binstart(int i, double p)
+{
+  if (i == 0)
+    return 1;
+  return (long)ceil(log(1 - (double)i / NBINS) / log(1 - p));
+}
+
+static int bin(long gap, double p)
+{
+  int i;
+
+  for (i=NBINS-1; i>0 && gap < binstart(i, p); i--)
+    ;
+  return i;
+}
+
+static void run(double p, int skip, long n, unsigned int seed, struct result *r)
+{
+  struct rng rng;
+  struct channel ch;
+  struct pkt packet;
+  struct timeval t0, t1;
+  long i, last = 0;
+
+  memset(&ch, 0, sizeof ch);
+  memset(r, 0, sizeof *r);
+  rng_seed(&rng, seed);
+  ch.rng = &rng;
+  ch.lossprob = p;
+  ch.corruptprob = p;
+  ch.model = CHANNEL_BERNOULLI;
+  ch.skip = skip;
+  memset(&packet, 0, sizeof packet);
+
+  gettimeofday(&t0, NULL);
+  for (i=1; i<=n; i++) {
+    if (channel_lost(&ch)) {
+      r->lost++;
+      if (last > 0)
+        r->observed[bin(i - last, p)]++;
+      last = i;
+    }
+    else if (channel_corrupt(&ch, &packet))
+      r->corrupted++;
+  }
+  gettimeofday(&t1, NULL);
+  r->draws = ch.draws;
+  r->seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+}
+
+/* chi-square statistic of the gaps against the geometric distribution */
+static double chisquare(const struct result *r, double p)
+{
+  double q = 1 - p, expected, x = 0, gaps = 0;
+  int i;
+
+  for (i=0; i<NBINS; i++)
+    gaps += r->observed[i];
+  for (i=0; i<NBINS; i++) {
+    /* P(gap >= start of bin i) - P(gap >= start of bin i+1) */
+    expected = pow(q, binstart(i, p) - 1);
+    if (i + 1 < NBINS)
+      expected -= pow(q, binstart(i + 1, p) - 1);
+    expected *= gaps;
+    if (expected > 0)
+      x += (r->observed[i] - expected) * (r->observed[i] - expected) / expected;
+  }
+  return x;
+}
+
+/* 99.9th percentile of chi-square with df degrees of freedom
+   (Wilson-Hilferty) */
+static double chi999(int df)
+{
+  double a = 2.0 / (9 * df);
+
+  return df * pow(1 - a + 3.090 * sqrt(a), 3);
+}
+
+int main(int argc, char **argv)
+{
+  static const double probs[] = { 0.001, 0.01, 0.1 };
+  struct result r;
+  long n = argc > 1 ? atol(argv[1]) : 10000000;
+  unsigned int seed = argc > 2 ? strtoul(argv[2], NULL, 10) : 9999;
+  double p, loss, corrupt, se, x;
+  int i, skip, failed = 0, bad;
+
+  if (n < 1000) {
+    printf("usage: %s [packets [seed]]   (at least 1000 packets)\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  printf("%ld packets per run, seed %u\n", n, seed);
+  printf("p      sampling    loss rate  corrupt rate  gap chi2 (crit %.1f)  draws/packet  Mpackets/s\n",
+         chi999(NBINS - 1));
+  for (i=0; i<(int)(sizeof probs / sizeof probs[0]); i++)
+    for (skip=0; skip<=1; skip++) {
+      p = probs[i];
+      run(p, skip, n, seed, &r);
+      loss = (double)r.lost / n;
+      corrupt = (double)r.corrupted / (n - r.lost);
+      se = sqrt(p * (1 - p) / n);
+      x = chisquare(&r, p);
+      bad = fabs(loss - p) > 4 * se || fabs(corrupt - p) > 4 * sqrt(p * (1 - p) / (n - r.lost))
+            || (skip && x > chi999(NBINS - 1));
+      failed |= bad;
+      printf("%-6g %-11s %-10.6f %-13.6f %-21.1f %-13.3f %.1f%s\n", p,
+             skip ? "skip" : "per packet", loss, corrupt, x, (double)r.draws / n,
+             r.seconds > 0 ? n / r.seconds / 1e6 : 0, bad ? "  FAIL" : "");
+    }
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "emulator.h"
+#include "channel.h"
+
+/****************************************************************************/
+/* The loss, delay and corruption model of the emulated medium, shared by   */
+/* every program that moves packets between A and B.                        */
+/****************************************************************************/
+
+/* uniform in [0,1], traced like jimsrand() */
+static double uniform(struct channel *ch)
+{
+  double x;
+
+  x = rng_next(ch->rng)/(double)RNG_MAX;
+  ch->draws++;
+  if (TRACE > 3)
+    printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
+  return x;
+}
+
+/* packets up to and including the next one hit with probability p:
+   one plus a geometric number of misses, drawn by inversion */
+static long gap(struct channel *ch, float p)
+{
+  double u, k;
+
+  if (p <= 0)
+    return LONG_MAX;
+  if (p >= 1)
+    return 1;
+  u = 1 - uniform(ch);                 /* in (0,1] */
+  if (u <= 0)
+    u = 1 / ((double)RNG_MAX + 1);
+  k = floor(log(u) / log1p(-(double)p));
+  return k < LONG_MAX - 1 ? (long)k + 1 : LONG_MAX;
+}
+
+/* the next record of the trace; the trace wraps around at its end */
+static const struct tracerec *nextrec(struct channel *ch)
+{
+  if (ch->tracepos >= ch->trace->count)
+    ch->tracepos = 0;
+  return &ch->trace->rec[ch->tracepos++];
+}
+
+int channel_lost(struct channel *ch)
+{
+  switch (ch->model) {
+  case CHANNEL_GILBERT:
+    if (uniform(ch) < (ch->bad ? ch->ge.r : ch->ge.p))
+      ch->bad = !ch->bad;
+    return uniform(ch) < (ch->bad ? ch->ge.lossbad : ch->ge.lossgood);
+  case CHANNEL_REPLAY:
+    ch->cur = nextrec(ch);
+    return ch->cur->lost;
+  default:
+    if (ch->skip) {
+      if (ch->lossleft == 0)
+        ch->lossleft = gap(ch, ch->lossprob);
+      return --ch->lossleft == 0;
+    }
+    return uniform(ch) < ch->lossprob;
+  }
+}
+
+/* medium can not reorder, so the packet arrives between 1 and 10 time
+   units after the latest arrival time of packets already on their way */
+float channel_arrival(struct channel *ch, float lastime)
+{
+  if (ch->model == CHANNEL_REPLAY)
+    return lastime + ch->cur->delay;
+  if (ch->delay > 0)
+    return lastime + ch->delay / CHANNEL_MEANDELAY * (1 + 9*uniform(ch));
+  return lastime + 1 + 9*uniform(ch);
+}
+
+int channel_corrupt(struct channel *ch, struct pkt *packet)
+{
+  double x;
+
+  if (ch->model == CHANNEL_REPLAY) {
+    switch (ch->cur->corrupt) {
+    case 0: return 0;
+    case 1: packet->payload[0]='Z'; break;
+    case 2: packet->seqnum = 999999; break;
+    default: packet->acknum = 999999; break;
+    }
+    return 1;
+  }
+  if (ch->skip) {
+    if (ch->corruptleft == 0)
+      ch->corruptleft = gap(ch, ch->corruptprob);
+    if (--ch->corruptleft != 0)
+      return 0;
+  }
+  else if (!(uniform(ch) < ch->corruptprob))
+    return 0;
+  if ( (x = uniform(ch)) < .75)
+    packet->payload[0]='Z';   /* corrupt payload */
+  else if (x < .875)
+    packet->seqnum = 999999;
+  else
+    packet->acknum = 999999;
+  return 1;
+}
+
+struct trace *trace_open(const char *file)
+{
+  struct traceheader *h;
+  struct trace *t;
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    perror(file);
+    return NULL;
+  }
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct traceheader)) {
+    printf("trace: %s is not a trace file\n", file);
+    close(fd);
+    return NULL;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(file);
+    return NULL;
+  }
+  h = map;
+  if (h->magic != TRACEMAGIC || h->version != TRACEVERSION || h->count == 0
+      || h->count > (st.st_size - sizeof *h) / sizeof(struct tracerec)) {
+    printf("trace: %s is not a trace file\n", file);
+    munmap(map, st.st_size);
+    return NULL;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);   /* read ahead, drop behind */
+  t = malloc(sizeof *t);
+  if (t == NULL) {
+    printf("memory allocation for trace failed.");
+    exit(EXIT_FAILURE);
+  }
+  t->rec = (const struct tracerec *)(h + 1);
+  t->count = h->count;
+  t->map = map;
+  t->maplen = st.st_size;
+  return t;
+}
+
+void trace_close(struct trace *t)
+{
+  if (t == NULL)
+    return;
+  munmap(t->map, t->maplen);
+  free(t);
+}
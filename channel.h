@@ -0,0 +1,101 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <stddef.h>
+#include "rng.h"
+
+/* loss models */
+#define CHANNEL_BERNOULLI 0     /* each packet is lost with lossprob */
+#define CHANNEL_GILBERT   1     /* two state Gilbert-Elliott bursty loss */
+#define CHANNEL_REPLAY    2     /* every decision is read from a trace */
+
+/* Gilbert-Elliott loss: before each packet the channel moves between a
+   good and a bad state, and the packet is then lost with the loss
+   probability of the state it is in.  The mean burst length in the bad
+   state is 1/r packets. */
+struct gilbert {
+  float p;                /* probability of going from good to bad */
+  float r;                /* probability of going from bad to good */
+  float lossgood;         /* loss probability in the good state */
+  float lossbad;          /* loss probability in the bad state */
+};
+
+/* A trace file holds a struct traceheader followed by count struct
+   tracerec, one per packet, in the byte order of the machine reading
+   it.  The file is mapped into memory and read in place, so it can be
+   much larger than memory; after the last record it starts again from
+   the first. */
+#define TRACEMAGIC 0x43525450   /* "PTRC" */
+#define TRACEVERSION 1
+
+struct traceheader {
+  unsigned int magic;
+  unsigned int version;
+  unsigned long long count;     /* number of records */
+};
+
+struct tracerec {
+  float delay;            /* time units after the send time or the latest
+                             arrival still in flight, whichever is later */
+  unsigned char lost;     /* nonzero if the packet is dropped */
+  unsigned char corrupt;  /* 0 intact, 1 payload, 2 seqnum, 3 acknum */
+  unsigned char pad[2];
+};
+
+/* a trace file mapped into memory */
+struct trace {
+  const struct tracerec *rec;
+  unsigned long long count;
+  void *map;
+  size_t maplen;
+};
+
+#define CHANNEL_MEANDELAY 5.5   /* mean of the original 1 + 9u delay */
+
+/* One direction of the emulated medium.  The decisions for each packet
+   are drawn from rng in the same order as the original tolayer3():
+   loss, then arrival time, then corruption (and how it is corrupted),
+   so a channel fed from the emulator's stream reproduces its results. */
+struct channel {
+  float lossprob;         /* probability that a packet is dropped */
+  float corruptprob;      /* probability that a packet is corrupted */
+  float delay;            /* mean delay on an empty medium, 0 for the
+                             original CHANNEL_MEANDELAY */
+  struct rng *rng;        /* stream the decisions are drawn from */
+  int model;              /* CHANNEL_BERNOULLI, _GILBERT or _REPLAY */
+  struct gilbert ge;      /* parameters of the Gilbert-Elliott model */
+  int bad;                /* Gilbert-Elliott state, 1 if bad */
+  struct trace *trace;    /* trace being replayed */
+  unsigned long long tracepos;  /* next record of the trace */
+  const struct tracerec *cur;   /* record of the packet being sent */
+  int skip;               /* draw the gaps between losses and corruptions */
+  long lossleft;          /* packets up to and including the next loss */
+  long corruptleft;       /* and corruption, 0 if not drawn yet */
+  unsigned long draws;    /* random numbers drawn */
+};
+
+/* With skip set, instead of drawing a random number for every packet
+   to decide whether it is lost (or corrupted), the channel draws how
+   many packets pass before the next loss (corruption) from the
+   geometric distribution and counts them down.  The losses and
+   corruptions follow the same distribution as with a draw per packet
+   but take far fewer random numbers when they are rare.  It applies to
+   Bernoulli loss and to corruption in the Bernoulli and Gilbert-Elliott
+   models. */
+
+/* true if the next packet is lost */
+extern int channel_lost(struct channel *);
+
+/* arrival time of a packet that follows one arriving at lastime */
+extern float channel_arrival(struct channel *, float lastime);
+
+/* possibly corrupt the packet, true if it was */
+extern int channel_corrupt(struct channel *, struct pkt *);
+
+/* map a trace file into memory, NULL on error */
+extern struct trace *trace_open(const char *file);
+
+/* unmap a trace opened by trace_open(); NULL is ignored */
+extern void trace_close(struct trace *);
+
+#endif
@@ -33,22 +33,113 @@
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Modifications:
+   - random numbers come from a struct rng stream (rng.c) rather than
+   rand(), so the generator state can be saved with the rest of the
+   simulation.  Results are unchanged.
+   - the complete simulator state (event list, clock, random number
+   state, statistics and the protocol state) can be saved to a snapshot
+   file (--save, taken at --at <time> or --on-full) and a run started
+   from one (--restore).  Each --variant <loss>,<corrupt> forks a copy of
+   the simulation at the snapshot point which continues with its own
+   loss and corruption probabilities.
+   - several connections can share the channel (--connections).  Events
+   carry the connection id, the event list is a binary heap and timers
+   are found without searching it, so runs scale to 100k connections.
+   - the loss, delay and corruption decisions of tolayer3() are made by
+   the channel model in channel.c, shared with the parallel simulator.
+   - each direction can lose packets in bursts with a Gilbert-Elliott
+   model (--gilbert-ab, --gilbert-ba) or replay the loss, delay and
+   corruption of every packet from a memory-mapped trace file
+   (--replay-ab, --replay-ba).
+   - the window, packets in flight, medium backlog, deliveries and
+   resends can be sampled every --sample time units of simulated time
+   and written to a CSV or binary file when the simulation ends.
+   - with --skip-sampling the channel draws the number of packets until
+   the next loss or corruption instead of deciding packet by packet.
+   - messages can come from layer 5 as a Poisson process, in Pareto
+   ON/OFF bursts, at times read from a file, or as fast as the window
+   allows (--source).  --until ends the simulation at a given time,
+   which a saturated gbn.c needs: six packets of 5.5 time units each
+   outlast its timer of 16, so it never stops resending.
+   - --latency reports the mean, median, 95th and 99th percentile and
+   maximum time from a message leaving layer 5 at A to its delivery at B.
+   - with protocols built with -DFEC (add fec.c to the build) the report
+   gives the parity packets sent and the packets B rebuilt from them.
+   - --path stripes packets over several paths with their own loss,
+   corruption and delay, picked round-robin, by expected delay or by loss
+   (--scheduler), and puts them back in order at the other side.  The
+   report compares the goodput with runs over each path alone.
+   - the next message from layer 5 is kept beside the event heap instead
+   of in it, so arrivals cost no heap operations or allocations.  Results
+   are unchanged.
+   - --seed sets the seed of the random number stream and --delay the
+   mean delay of the medium.
+   - --replicate runs the simulation with one seed after another, several
+   at a time, until the means of the goodput, resends and full window
+   drops are known to the precision asked for, and writes the results of
+   each run to a file as it ends.
+
+   Build with: gcc emulator.c rng.c channel.c stats.c gbn.c -lm   (or sr.c)
+
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/time.h>
 #include "emulator.h"
 #include "gbn.h"
+#include "rng.h"
+#include "channel.h"
+#include "stats.h"
+#if FEC
+#include "fec.h"
+#endif
 
 struct event {
   float evtime;           /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
+  int conn;               /* connection the event belongs to */
   struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
-  struct event *next;
+  int path;               /* multipath: path the packet took */
+  unsigned long pathseq;  /* and its place in the order it was sent */
+  float sent;             /* time it was sent */
+  float start;            /* and left the packets ahead of it on its path */
+  unsigned long seq;      /* insertion order */
+  int heapidx;            /* position in evheap */
+  struct event *next;     /* next free event */
 };
 
-struct event *evlist = NULL;   /* the event list */
+/* The event list is a binary heap ordered by time, so that events can be
+   inserted and removed in O(log n) with many connections.  Of events with
+   the same time the one inserted last comes first, which is the order
+   the original sorted linked list gave them. */
+static struct event **evheap = NULL;
+static int nevents = 0;
+static int evheapsize = 0;
+static unsigned long nextseq = 0;
+static struct event *freeevents = NULL;  /* events to reuse */
+
+/* Messages from layer 5 come one after the other: the next one is set up
+   when the last arrives.  It is kept here rather than in the heap, and
+   the main loop takes whichever of it and the top of the heap comes
+   first, in the same order as if it were in the heap. */
+static struct event arrival;      /* next arrival from layer 5 */
+static int arrivalpending;        /* arrival is set */
+static struct event arriving;     /* the arrival being simulated */
+
+int nconnections = 1;             /* number of A/B connections */
+int connection;                   /* connection being served */
+static struct event **timers[2];  /* running timer of each connection at A and B */
+static float *lastarrival[2];     /* latest arrival time of each connection's packets in flight to A and B */
 
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
@@ -84,17 +175,120 @@ static float lambda;        /* arrival rate of messages from layer 5 */
 static int   ntolayer3;           /* number sent into layer 3 */
 static int   nlost;               /* number lost in media */
 static int ncorrupt;              /* number corrupted by media*/
+static struct rng rng;            /* random number stream for the emulator */
+static struct channel channels[2];  /* medium for packets sent by A and by B */
+static int gilberton[2];          /* channels[] using Gilbert-Elliott loss */
+static struct gilbert gilbert[2]; /* and its parameters */
+static char replayfile[2][256];   /* trace replayed by channels[], if any */
+static int skipsampling;          /* draw gaps between losses and corruptions */
+static float delay;               /* mean delay of the medium, 0 for the original */
+static unsigned int seed = 9999;  /* of the random number stream */
+
+/* snapshots and forked variants */
+#define MAXVARIANTS 64
+static char *savefile;            /* write a snapshot to this file */
+static char *restorefile;         /* start from the snapshot in this file */
+static float snaptime = -1;       /* take the snapshot at this time */
+static int snaponfull;            /* take the snapshot when the window first fills */
+static int snaptaken;             /* snapshot point has been passed */
+static int nvariants;             /* number of variants to fork at the snapshot point */
+static float variantloss[MAXVARIANTS];
+static float variantcorrupt[MAXVARIANTS];
+static int variant = -1;          /* variant run by this process, -1 for the base run */
+
+/* layer 5 sources */
+#define SRC_UNIFORM  0            /* uniform on [0,2*lambda], the original */
+#define SRC_POISSON  1            /* exponential with mean lambda */
+#define SRC_ONOFF    2            /* Poisson during Pareto ON periods */
+#define SRC_TRACE    3            /* arrival times read from a file */
+#define SRC_SATURATE 4            /* a message whenever the window has room */
+static int source = SRC_UNIFORM;
+static float onmean, offmean;     /* mean ON and OFF period lengths */
+static float paretoshape = 1.5;   /* shape of their Pareto distribution */
+static float onleft;              /* time left in the current ON period */
+static char sourcefile[256];      /* arrival times for SRC_TRACE */
+static float *arrivals;
+static long narrivals;
+static long nextarrival;          /* next of arrivals[] to use */
+static float until = -1;          /* end the simulation at this time, -1 for never */
+
+static long nsimulated;           /* events simulated by this process */
+static struct timeval starttime;  /* wall clock time the simulation started */
+
+/* time series sampling */
+static float sampleinterval;      /* time units between samples, 0 for none */
+static char *samplefile;          /* write the samples to this file */
+static int samplebinary;          /* as binary columns instead of CSV */
+static float nextsample = FLT_MAX;  /* time of the next sample */
+static long nextsampleno;         /* nextsample / sampleinterval */
+static int inflight;              /* packets in the medium */
+static float latestarrival[2];    /* latest arrival in flight to A and B */
+
+/* delivery latency: the protocols deliver every message A accepts once
+   and in order, so each delivery at B belongs to the oldest message of
+   its connection that A accepted and B has not delivered yet */
+struct sendtimes {
+  float *t;                       /* times A accepted them, oldest first */
+  int head, n, size;
+};
+static int latencyon;             /* measure the delivery latency */
+static struct sendtimes *sendtimes;  /* per connection */
+static float *latencies;          /* latency of every message delivered */
+static long nlatencies, latencysize;
+
+/* multipath: packets are striped over several paths, each with its own
+   loss, corruption and delay, and put back in the order they were sent
+   before the protocol sees them */
+#define MAXPATHS 8
+#define SCHED_RR   0              /* take the paths in turn */
+#define SCHED_RTT  1              /* the path with the earliest expected arrival */
+#define SCHED_LOSS 2              /* weighted round-robin by delivery rate */
+#define PATHGAIN 0.125            /* weight of the latest packet in the estimates */
+struct path {
+  float lossprob, corruptprob, delay;  /* as given by --path */
+  struct channel ch[2];           /* packets sent by A and by B */
+  /* per sending entity: */
+  long sent[2], lost[2], arrived[2];
+  double delaysum[2];             /* one-way delay of the packets arrived */
+  float delayest[2];              /* smoothed delay behind the packets
+                                     ahead, for SCHED_RTT */
+  float lossest[2];               /* smoothed loss, for SCHED_LOSS */
+  float credit[2];                /* weighted round-robin credit */
+};
+struct resequencer {
+  unsigned long sent;             /* place of the next packet sent */
+  unsigned long next;             /* place of the next packet to deliver */
+  int size;                       /* slots, a power of two */
+  struct pkt **slot;              /* packets arrived ahead of next */
+};
+static int npaths;                /* 0: the single medium of channels[] */
+static struct path paths[MAXPATHS];
+static int scheduler = SCHED_RR;
+static int nextpath[2];           /* SCHED_RR: next path of A and of B */
+static float *pathlast[2];        /* latest arrival per connection and path */
+static struct resequencer *reseq[2];  /* per connection at A and at B */
+static struct pkt lostmark;       /* slot of a packet lost on its path */
+static int alone = -1;            /* path used alone by a comparison run */
+static int alonefd[MAXPATHS];     /* goodput of the comparison runs */
+
+/* replication */
+#define MINREPLICATES 5           /* before the precision is tested */
+static float replicateprecision;  /* relative half width wanted, 0 for one run */
+static int replicatejobs;         /* replicates at a time, 0 for one per CPU */
+static int maxreplicates = 1000;
+static char *replicatefile = "replicates.csv";  /* results of every replicate */
+static int replicatefd = -1;      /* pipe to the parent, in a replicate */
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
 /* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* generator return an int in therange [0,mmm]                              */
 /****************************************************************************/
 double jimsrand(void) 
 {
-  double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
+  double mmm = RNG_MAX;      /* largest int returned by rng_next()          */
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
+  x = rng_next(&rng)/mmm;    /* x should be uniform in [0,1] */
   if (TRACE > 3)
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
@@ -104,41 +298,203 @@ double jimsrand(void)
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+/* true if event a is to be simulated before event b */
+static int earlier(struct event *a, struct event *b)
 {
-  struct event *q,*qold;
+  if (a->evtime != b->evtime)
+    return a->evtime < b->evtime;
+  return a->seq > b->seq;
+}
+
+static void heapswap(int i, int j)
+{
+  struct event *p = evheap[i];
+
+  evheap[i] = evheap[j];
+  evheap[j] = p;
+  evheap[i]->heapidx = i;
+  evheap[j]->heapidx = j;
+}
+
+/* move the event at i up or down the heap to where it belongs */
+static void heapfix(int i)
+{
+  int child;
 
+  while (i > 0 && earlier(evheap[i], evheap[(i-1)/2])) {
+    heapswap(i, (i-1)/2);
+    i = (i-1)/2;
+  }
+  while ((child = 2*i+1) < nevents) {
+    if (child+1 < nevents && earlier(evheap[child+1], evheap[child]))
+      child++;
+    if (!earlier(evheap[child], evheap[i]))
+      break;
+    heapswap(i, child);
+    i = child;
+  }
+}
+
+/* add an event that already has its seq */
+static void heappush(struct event *p)
+{
+  if (nevents == evheapsize) {
+    evheapsize = evheapsize ? 2*evheapsize : 1024;
+    evheap = realloc(evheap, evheapsize * sizeof(struct event *));
+    if (evheap == 0) {
+      printf("memory allocation for event list failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  evheap[nevents] = p;
+  p->heapidx = nevents++;
+  heapfix(p->heapidx);
+}
+
+/* take an event off the list */
+static void removeevent(struct event *p)
+{
+  int i = p->heapidx;
+
+  if (p->evtype == TIMER_INTERRUPT)
+    timers[p->eventity][p->conn] = NULL;
+  nevents--;
+  if (i != nevents) {
+    evheap[i] = evheap[nevents];
+    evheap[i]->heapidx = i;
+    heapfix(i);
+  }
+}
+
+struct event *newevent(void)
+{
+  struct event *evptr;
+
+  if (freeevents != NULL) {
+    evptr = freeevents;
+    freeevents = evptr->next;
+    return evptr;
+  }
+  evptr = malloc(sizeof(struct event));
+  if (evptr == 0) {
+    printf("memory allocation for event failed.");
+    exit(EXIT_FAILURE);
+  }
+  return evptr;
+}
+
+void freeevent(struct event *evptr)
+{
+  evptr->next = freeevents;
+  freeevents = evptr;
+}
+
+void insertevent(struct event *p)
+{
   if (TRACE>2) {
     printf("            INSERTEVENT: time is %f\n",time);
     printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
   }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
+  p->seq = nextseq++;
+  if (p == &arrival) {
+    arrivalpending = 1;
+    return;
   }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
-    }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
+  if (p->evtype == TIMER_INTERRUPT)
+    timers[p->eventity][p->conn] = p;
+  heappush(p);
+}
+
+/* the next event to simulate, NULL if there is none */
+struct event *firstevent(void)
+{
+  struct event *p = nevents > 0 ? evheap[0] : NULL;
+
+  if (arrivalpending && (p == NULL || earlier(&arrival, p)))
+    p = &arrival;
+  return p;
+}
+
+/* take the next event to simulate off the list */
+struct event *popevent(void)
+{
+  struct event *p = firstevent();
+
+  if (p == &arrival) {
+    arriving = arrival;         /* the next arrival is set up in its place */
+    arrivalpending = 0;
+    return &arriving;
+  }
+  removeevent(p);
+  return p;
+}
+
+/* exponentially distributed with the given mean */
+double exponential(double mean)
+{
+  double u;
+
+  u = 1 - jimsrand();
+  if (u <= 0)
+    u = DBL_MIN;
+  return -mean * log(u);
+}
+
+/* Pareto distributed with the given mean and shape paretoshape */
+double pareto(double mean)
+{
+  double u;
+
+  u = 1 - jimsrand();
+  if (u <= 0)
+    u = DBL_MIN;
+  return mean * (paretoshape - 1) / paretoshape / pow(u, 1 / paretoshape);
+}
+
+/* time to the next message of the ON/OFF source: messages come as a
+   Poisson process during ON periods and not at all during OFF periods */
+double onoff_gap(void)
+{
+  double x = 0, gap;
+
+  while (1) {
+    gap = exponential(lambda);
+    if (gap <= onleft) {
+      onleft -= gap;
+      return x + gap;
     }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
+    /* the ON period ends first; the gap is memoryless so it starts
+       again with the next ON period */
+    x += onleft + pareto(offmean);
+    onleft = pareto(onmean);
+  }
+}
+
+/* read the arrival times of SRC_TRACE, one per line */
+void loadarrivals(void)
+{
+  FILE *fp;
+  float t;
+  long size = 0;
+
+  fp = fopen(sourcefile, "r");
+  if (fp == NULL) {
+    perror(sourcefile);
+    exit(EXIT_FAILURE);
+  }
+  narrivals = 0;
+  while (fscanf(fp, "%f", &t) == 1) {
+    if (narrivals == size) {
+      size = size ? 2 * size : 1024;
+      arrivals = realloc(arrivals, size * sizeof(float));
+      if (arrivals == NULL) {
+        printf("memory allocation for arrivals failed.");
+        exit(EXIT_FAILURE);
+      }
     }
+    arrivals[narrivals++] = t;
   }
+  fclose(fp);
 }
 
 void generate_next_arrival(void)
@@ -146,33 +502,336 @@ void generate_next_arrival(void)
   double x;
   struct event *evptr;
 
+  if (source == SRC_SATURATE)
+    return;                   /* messages are offered by saturate() */
+  if (source == SRC_TRACE && nextarrival == narrivals)
+    return;                   /* no more arrivals in the file */
   if (TRACE>2)
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
-  /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
+  switch (source) {
+  case SRC_POISSON:
+    x = exponential(lambda);
+    break;
+  case SRC_ONOFF:
+    x = onoff_gap();
+    break;
+  case SRC_TRACE:
+    x = arrivals[nextarrival++] - time;
+    if (x < 0)
+      x = 0;
+    break;
+  default:
+    x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+    /* having mean of lambda        */
   }
+  evptr = &arrival;
   evptr->evtime =  time + x;
   evptr->evtype =  FROM_LAYER5;
   if (BIDIRECTIONAL && (jimsrand()>0.5) )
     evptr->eventity = B;
   else
     evptr->eventity = A;
+  evptr->conn = 0;
+  if (nconnections > 1) {   /* message is for a random connection */
+    evptr->conn = jimsrand() * nconnections;
+    if (evptr->conn == nconnections)
+      evptr->conn = nconnections - 1;
+  }
   insertevent(evptr);
 } 
 
+/* set up the medium in each direction from the loss/corruption settings */
+void setchannels(void)
+{
+  int AorB;
+
+  for (AorB=A; AorB<=B; AorB++) {
+    channels[AorB].rng = &rng;
+    /* corruptdirection limits loss and corruption to one direction */
+    if (corruptdirection == (AorB+1) % 2) {
+      channels[AorB].lossprob = 0;
+      channels[AorB].corruptprob = 0;
+    }
+    else {
+      channels[AorB].lossprob = lossprob;
+      channels[AorB].corruptprob = corruptprob;
+    }
+    channels[AorB].model = CHANNEL_BERNOULLI;
+    if (gilberton[AorB]) {
+      channels[AorB].model = CHANNEL_GILBERT;
+      channels[AorB].ge = gilbert[AorB];
+    }
+    if (channels[AorB].trace != NULL)
+      channels[AorB].model = CHANNEL_REPLAY;
+    channels[AorB].skip = skipsampling;
+    channels[AorB].delay = delay;
+  }
+}
+
+/* map the traces to be replayed */
+void openreplays(void)
+{
+  int AorB;
+
+  for (AorB=A; AorB<=B; AorB++)
+    if (replayfile[AorB][0] != 0 && channels[AorB].trace == NULL) {
+      channels[AorB].trace = trace_open(replayfile[AorB]);
+      if (channels[AorB].trace == NULL)
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int evcompare(const void *a, const void *b)
+{
+  struct event *p = *(struct event **)a, *q = *(struct event **)b;
+
+  return earlier(p, q) ? -1 : earlier(q, p) ? 1 : 0;
+}
+
+/* a copy of the event list in the order the events will be simulated */
+struct event **sortedevents(void)
+{
+  struct event **list;
+
+  list = malloc((nevents+1) * sizeof(struct event *));
+  if (list == 0) {
+    printf("memory allocation for event list failed.");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(list, evheap, nevents * sizeof(struct event *));
+  if (arrivalpending)
+    list[nevents] = &arrival;
+  qsort(list, nevents + arrivalpending, sizeof(struct event *), evcompare);
+  return list;
+}
+
 void printevlist(void)
 {
-  struct event *q;
+  struct event **list;
+  int i;
+
+  list = sortedevents();
   printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
-    printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
+  for (i=0; i<nevents+arrivalpending; i++) {
+    printf("Event time: %f, type: %d entity: %d\n",list[i]->evtime,list[i]->evtype,list[i]->eventity);
   }
   printf("--------------\n");
+  free(list);
+}
+
+/* set up the per-connection state of the emulator */
+void initconnections(void)
+{
+  int AorB;
+
+  for (AorB=A; AorB<=B; AorB++) {
+    free(timers[AorB]);
+    free(lastarrival[AorB]);
+    timers[AorB] = calloc(nconnections, sizeof(struct event *));
+    lastarrival[AorB] = calloc(nconnections, sizeof(float));
+    if (timers[AorB] == 0 || lastarrival[AorB] == 0) {
+      printf("memory allocation for connections failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/********************** REPLICATION ***********************/
+/*  With --replicate the settings are read once and then the simulation   */
+/*  is run again and again with seeds seed, seed+1, ..., --jobs runs at a  */
+/*  time, each in a child forked just before the random number stream is  */
+/*  seeded, so replicate k gives exactly what a run with --seed seed+k     */
+/*  would.  The children send their results back through pipes.  The      */
+/*  results are written to the replicate file as they come in but taken   */
+/*  into the means in seed order, so that runs which finish early (those   */
+/*  with little loss, say) do not decide when to stop.  The runs stop once  */
+/*  the 95% confidence interval of every mean is within the requested      */
+/*  share of it.                                                           */
+/**************************************************************************/
+
+struct replicate {
+  int done;                       /* the result has come in */
+  float time;                     /* the simulation ended */
+  int delivered, resent, full;
+};
+
+struct replicaterun {
+  pid_t pid;
+  int fd;                         /* read end of its pipe */
+  int rep;
+};
+
+/* the means reported and tested for precision */
+#define NMEASURES 3
+static const char *measurenames[NMEASURES] = {
+  "goodput (messages per time unit)", "packet resends by A", "messages dropped due to full window"
+};
+
+static double measure(const struct replicate *r, int i)
+{
+  switch (i) {
+  case 0: return r->time > 0 ? r->delivered / r->time : 0;
+  case 1: return r->resent;
+  default: return r->full;
+  }
+}
+
+/* a replicate is over: hand its results to the parent */
+void replicate_done(void)
+{
+  struct replicate r;
+
+  r.done = 1;
+  r.time = time;
+  r.delivered = messages_delivered;
+  r.resent = packets_resent;
+  r.full = window_full;
+  if (write(replicatefd, &r, sizeof r) != sizeof r)
+    perror("write");
+  exit(EXIT_SUCCESS);
+}
+
+/* fork the replicate with seed base + rep; 0 in the child */
+static pid_t replicate_start(struct replicaterun *run, int rep, unsigned int base)
+{
+  int fd[2];
+  pid_t pid;
+
+  if (pipe(fd) < 0) {
+    perror("pipe");
+    exit(EXIT_FAILURE);
+  }
+  fflush(stdout);
+  pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+  if (pid == 0) {
+    close(fd[0]);
+    replicatefd = fd[1];
+    seed = base + rep;
+    TRACE = 0;
+    return 0;
+  }
+  close(fd[1]);
+  run->pid = pid;
+  run->fd = fd[0];
+  run->rep = rep;
+  return pid;
+}
+
+/* the means are as precise as asked for */
+static int precise(const struct running *stats)
+{
+  int i;
+
+  if (stats[0].n < MINREPLICATES)
+    return 0;
+  for (i=0; i<NMEASURES; i++)
+    if (running_ci95(&stats[i]) > replicateprecision * fabs(stats[i].mean))
+      return 0;
+  return 1;
+}
+
+/* run the replicates, report and exit; returns only in the children */
+void replicate(void)
+{
+  struct replicate *results;
+  struct replicaterun *run;
+  struct pollfd *pfd;
+  struct running stats[NMEASURES];
+  struct replicate r;
+  unsigned int base = seed;
+  int started = 0, running = 0, next = 0, stop = 0, i, j, k;
+  ssize_t n;
+  FILE *fp;
+
+  results = calloc(maxreplicates, sizeof(struct replicate));
+  run = calloc(replicatejobs, sizeof(struct replicaterun));
+  pfd = calloc(replicatejobs, sizeof(struct pollfd));
+  if (results == NULL || run == NULL || pfd == NULL) {
+    printf("memory allocation for replicates failed.");
+    exit(EXIT_FAILURE);
+  }
+  fp = fopen(replicatefile, "w");
+  if (fp == NULL) {
+    perror(replicatefile);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(fp, "replicate,seed,time,delivered,goodput,resends,window_full\n");
+  fflush(fp);
+  memset(stats, 0, sizeof stats);
+
+  while (1) {
+    while (!stop && running < replicatejobs && started < maxreplicates) {
+      if (replicate_start(&run[running], started, base) == 0) {
+        free(results);
+        free(run);
+        free(pfd);
+        fclose(fp);
+        return;
+      }
+      started++;
+      running++;
+    }
+    if (running == 0)
+      break;
+
+    for (i=0; i<running; i++) {
+      pfd[i].fd = run[i].fd;
+      pfd[i].events = POLLIN;
+    }
+    if (poll(pfd, running, -1) < 0) {
+      perror("poll");
+      exit(EXIT_FAILURE);
+    }
+    for (i=running-1; i>=0; i--) {
+      if (pfd[i].revents == 0)
+        continue;
+      n = read(run[i].fd, &r, sizeof r);
+      k = run[i].rep;
+      close(run[i].fd);
+      waitpid(run[i].pid, NULL, 0);
+      run[i] = run[--running];
+      if (n != sizeof r) {
+        if (stop)                 /* killed */
+          continue;
+        printf("replicate %d (seed %u) failed\n", k, base + k);
+        exit(EXIT_FAILURE);
+      }
+      results[k] = r;
+      fprintf(fp, "%d,%u,%f,%d,%f,%d,%d\n", k, base + k, r.time, r.delivered,
+              measure(&r, 0), r.resent, r.full);
+      fflush(fp);
+    }
+
+    /* take what is in, in seed order */
+    while (!stop && next < started && results[next].done) {
+      for (j=0; j<NMEASURES; j++)
+        running_add(&stats[j], measure(&results[next], j));
+      next++;
+      if (precise(stats))
+        stop = 1;
+    }
+    /* the replicates still running are not needed */
+    if (stop)
+      for (i=0; i<running; i++)
+        kill(run[i].pid, SIGTERM);
+  }
+  fclose(fp);
+
+  printf("\n%ld replicates (seeds %u to %u), %s:\n", stats[0].n, base,
+         base + (unsigned int)stats[0].n - 1,
+         stop ? "precision reached" : "precision not reached");
+  for (j=0; j<NMEASURES; j++)
+    printf("%s:  mean %f, 95%% confidence interval %f to %f (+-%.1f%%), sd %f \n",
+           measurenames[j], stats[j].mean,
+           stats[j].mean - running_ci95(&stats[j]), stats[j].mean + running_ci95(&stats[j]),
+           stats[j].mean != 0 ? 100 * running_ci95(&stats[j]) / fabs(stats[j].mean) : 0,
+           running_sd(&stats[j]));
+  exit(EXIT_SUCCESS);
 }
 
 void init(void)                         /* initialize the simulator */
@@ -196,8 +855,10 @@ void init(void)                         /* initialize the simulator */
   printf("Enter TRACE:");
   scanf("%d",&TRACE);
 
-
-  srand(9999);              /* init random number generator */
+  if (replicateprecision > 0)
+    replicate();            /* returns in each replicate with its seed */
+  rng_seed(&rng, seed);     /* init random number generator */
+  setchannels();
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
     sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
@@ -226,9 +887,879 @@ void init(void)                         /* initialize the simulator */
   ncorrupt = 0;
 
   time=0.0;                    /* initialize time to 0.0 */
+  initconnections();
+  if (source == SRC_ONOFF)
+    onleft = pareto(onmean);   /* start in an ON period */
   generate_next_arrival();     /* initialize event list */
 }
 
+/********************** SNAPSHOTS ***********************/
+/*  A snapshot is a binary file holding everything needed to carry on a   */
+/*  simulation: the emulator's settings, clock, statistics and random     */
+/*  number state, every pending event (with its packet, if any) in list  */
+/*  order, followed by the state saved by the A and B entities.           */
+/**************************************************************************/
+
+#define SNAPMAGIC   0x50414e53   /* "SNAP" */
+#define SNAPVERSION 7
+
+struct snaphdr {
+  int magic;
+  int version;
+  int nsim, nsimmax;
+  float time, lossprob, corruptprob, lambda;
+  int corruptdirection;
+  int trace;
+  int window_full, total_ACKs_received, packets_resent, new_ACKs, packets_received;
+  int packets_lost, packets_corrupt, packets_sent, packets_timeout, messages_delivered;
+  int ntolayer3, nlost, ncorrupt;
+  struct rng rng;
+  int gilberton[2];
+  struct gilbert gilbert[2];
+  int bad[2];                   /* Gilbert-Elliott states */
+  char replayfile[2][256];
+  unsigned long long tracepos[2];
+  int skipsampling;
+  float delay;
+  long lossleft[2], corruptleft[2];
+  int source;
+  float onmean, offmean, paretoshape, onleft;
+  char sourcefile[256];
+  long nextarrival;
+  int nconnections;
+  unsigned long nextseq;
+  int nevents;                  /* number of struct snapevent that follow */
+};
+
+struct snapevent {
+  float evtime;
+  int evtype;
+  int eventity;
+  int conn;
+  unsigned long seq;
+  struct pkt pkt;               /* only meaningful for FROM_LAYER3 events */
+};
+
+/* write the simulation state to file, return 0 on error */
+int snapshot_save(const char *file)
+{
+  struct snaphdr h;
+  struct snapevent e;
+  struct event *q;
+  FILE *fp;
+  int i, ok;
+
+  fp = fopen(file, "wb");
+  if (fp == NULL) {
+    perror(file);
+    return 0;
+  }
+  memset(&h, 0, sizeof h);
+  h.magic = SNAPMAGIC;
+  h.version = SNAPVERSION;
+  h.nsim = nsim;
+  h.nsimmax = nsimmax;
+  h.time = time;
+  h.lossprob = lossprob;
+  h.corruptprob = corruptprob;
+  h.lambda = lambda;
+  h.corruptdirection = corruptdirection;
+  h.trace = TRACE;
+  h.window_full = window_full;
+  h.total_ACKs_received = total_ACKs_received;
+  h.packets_resent = packets_resent;
+  h.new_ACKs = new_ACKs;
+  h.packets_received = packets_received;
+  h.packets_lost = packets_lost;
+  h.packets_corrupt = packets_corrupt;
+  h.packets_sent = packets_sent;
+  h.packets_timeout = packets_timeout;
+  h.messages_delivered = messages_delivered;
+  h.ntolayer3 = ntolayer3;
+  h.nlost = nlost;
+  h.ncorrupt = ncorrupt;
+  h.rng = rng;
+  for (i=A; i<=B; i++) {
+    h.gilberton[i] = gilberton[i];
+    h.gilbert[i] = gilbert[i];
+    h.bad[i] = channels[i].bad;
+    memcpy(h.replayfile[i], replayfile[i], sizeof replayfile[i]);
+    h.tracepos[i] = channels[i].tracepos;
+    h.lossleft[i] = channels[i].lossleft;
+    h.corruptleft[i] = channels[i].corruptleft;
+  }
+  h.skipsampling = skipsampling;
+  h.delay = delay;
+  h.source = source;
+  h.onmean = onmean;
+  h.offmean = offmean;
+  h.paretoshape = paretoshape;
+  h.onleft = onleft;
+  memcpy(h.sourcefile, sourcefile, sizeof sourcefile);
+  h.nextarrival = nextarrival;
+  h.nconnections = nconnections;
+  h.nextseq = nextseq;
+  h.nevents = nevents + arrivalpending;
+
+  ok = fwrite(&h, sizeof h, 1, fp) == 1;
+  for (i=0; ok && i<h.nevents; i++) {
+    q = i < nevents ? evheap[i] : &arrival;
+    memset(&e, 0, sizeof e);
+    e.evtime = q->evtime;
+    e.evtype = q->evtype;
+    e.eventity = q->eventity;
+    e.conn = q->conn;
+    e.seq = q->seq;
+    if (q->evtype == FROM_LAYER3)
+      e.pkt = *q->pktptr;
+    ok = fwrite(&e, sizeof e, 1, fp) == 1;
+  }
+  ok = ok && A_save(fp) && B_save(fp);
+  if (fclose(fp) != 0)
+    ok = 0;
+  if (!ok)
+    printf("snapshot: unable to write %s\n", file);
+  else if (TRACE>0)
+    printf("          SNAPSHOT: state at time %f saved to %s\n", time, file);
+  return ok;
+}
+
+/* replace the simulation state with the one saved in file, return 0 on error */
+int snapshot_restore(const char *file)
+{
+  struct snaphdr h;
+  struct snapevent e;
+  struct event *evptr;
+  FILE *fp;
+  int i, ok;
+
+  fp = fopen(file, "rb");
+  if (fp == NULL) {
+    perror(file);
+    return 0;
+  }
+  if (fread(&h, sizeof h, 1, fp) != 1 || h.magic != SNAPMAGIC || h.version != SNAPVERSION) {
+    printf("snapshot: %s is not a snapshot file\n", file);
+    fclose(fp);
+    return 0;
+  }
+  nsim = h.nsim;
+  nsimmax = h.nsimmax;
+  time = h.time;
+  lossprob = h.lossprob;
+  corruptprob = h.corruptprob;
+  lambda = h.lambda;
+  corruptdirection = h.corruptdirection;
+  TRACE = h.trace;
+  window_full = h.window_full;
+  total_ACKs_received = h.total_ACKs_received;
+  packets_resent = h.packets_resent;
+  new_ACKs = h.new_ACKs;
+  packets_received = h.packets_received;
+  packets_lost = h.packets_lost;
+  packets_corrupt = h.packets_corrupt;
+  packets_sent = h.packets_sent;
+  packets_timeout = h.packets_timeout;
+  messages_delivered = h.messages_delivered;
+  ntolayer3 = h.ntolayer3;
+  nlost = h.nlost;
+  ncorrupt = h.ncorrupt;
+  rng = h.rng;
+  for (i=A; i<=B; i++) {
+    gilberton[i] = h.gilberton[i];
+    gilbert[i] = h.gilbert[i];
+    channels[i].bad = h.bad[i];
+    if (strcmp(replayfile[i], h.replayfile[i]) != 0) {
+      trace_close(channels[i].trace);   /* replay the snapshot's trace */
+      channels[i].trace = NULL;
+    }
+    memcpy(replayfile[i], h.replayfile[i], sizeof replayfile[i]);
+    channels[i].tracepos = h.tracepos[i];
+    channels[i].lossleft = h.lossleft[i];
+    channels[i].corruptleft = h.corruptleft[i];
+  }
+  skipsampling = h.skipsampling;
+  delay = h.delay;
+  source = h.source;
+  onmean = h.onmean;
+  offmean = h.offmean;
+  paretoshape = h.paretoshape;
+  onleft = h.onleft;
+  memcpy(sourcefile, h.sourcefile, sizeof sourcefile);
+  if (source == SRC_TRACE)
+    loadarrivals();
+  nextarrival = h.nextarrival;
+  openreplays();
+  setchannels();
+  nconnections = h.nconnections;
+  initconnections();
+  A_init();
+  B_init();
+
+  /* rebuild the event list; the saved seq keeps the order of events
+     with equal times */
+  nevents = 0;
+  arrivalpending = 0;
+  nextseq = h.nextseq;
+  ok = 1;
+  for (i=0; ok && i<h.nevents; i++) {
+    if (fread(&e, sizeof e, 1, fp) != 1) {
+      ok = 0;
+      break;
+    }
+    evptr = e.evtype == FROM_LAYER5 ? &arrival : newevent();
+    evptr->evtime = e.evtime;
+    evptr->evtype = e.evtype;
+    evptr->eventity = e.eventity;
+    evptr->conn = e.conn;
+    evptr->seq = e.seq;
+    evptr->pktptr = NULL;
+    if (e.evtype == FROM_LAYER3) {
+      evptr->pktptr = malloc(sizeof(struct pkt));
+      if (evptr->pktptr == 0) {
+        printf("memory allocation for event failed.");
+        exit(EXIT_FAILURE);
+      }
+      *evptr->pktptr = e.pkt;
+      if (e.evtime > lastarrival[e.eventity][e.conn])
+        lastarrival[e.eventity][e.conn] = e.evtime;
+      if (e.evtime > latestarrival[e.eventity])
+        latestarrival[e.eventity] = e.evtime;
+      inflight++;
+    }
+    if (e.evtype == TIMER_INTERRUPT)
+      timers[e.eventity][e.conn] = evptr;
+    if (evptr == &arrival)
+      arrivalpending = 1;
+    else
+      heappush(evptr);
+  }
+  ok = ok && A_restore(fp) && B_restore(fp);
+  fclose(fp);
+  if (!ok)
+    printf("snapshot: %s is truncated\n", file);
+  else if (TRACE>0)
+    printf("          SNAPSHOT: state at time %f restored from %s\n", time, file);
+  return ok;
+}
+
+/* fork one copy of the simulation for each variant.  The children share
+   the parent's memory copy-on-write and carry on from the current state
+   with their own loss and corruption probabilities; the parent carries on
+   as the base run. */
+void fork_variants(void)
+{
+  pid_t pid;
+  int i;
+
+  fflush(stdout);
+  for (i=0; i<nvariants; i++) {
+    pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+      variant = i;
+      lossprob = variantloss[i];
+      corruptprob = variantcorrupt[i];
+      setchannels();
+      /* the gaps were drawn for the old probabilities; since they are
+         memoryless they can simply be drawn again */
+      channels[A].lossleft = channels[B].lossleft = 0;
+      channels[A].corruptleft = channels[B].corruptleft = 0;
+      if (TRACE>0)
+        printf("          VARIANT %d: loss %f, corruption %f from time %f\n",
+               variant, lossprob, corruptprob, time);
+      return;
+    }
+  }
+}
+
+/* the snapshot point has been reached: save and/or branch the simulation */
+void checkpoint(void)
+{
+  snaptaken = 1;
+  if (savefile != NULL && !snapshot_save(savefile))
+    exit(EXIT_FAILURE);
+  if (nvariants > 0)
+    fork_variants();
+}
+
+/********************** LATENCY ***********************/
+
+void latency_init(void)
+{
+  if (!latencyon)
+    return;
+  sendtimes = calloc(nconnections, sizeof(struct sendtimes));
+  if (sendtimes == NULL) {
+    printf("memory allocation for latency failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* A accepted n messages of the current connection at the current time */
+void latency_sent(int n)
+{
+  struct sendtimes *q;
+  float *t;
+  int i;
+
+  if (!latencyon)
+    return;
+  q = &sendtimes[connection];
+  if (q->n + n > q->size) {
+    t = malloc(2 * (q->size + n) * sizeof(float));
+    if (t == NULL) {
+      printf("memory allocation for latency failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<q->n; i++)
+      t[i] = q->t[(q->head + i) % q->size];
+    free(q->t);
+    q->t = t;
+    q->head = 0;
+    q->size = 2 * (q->size + n);
+  }
+  for (i=0; i<n; i++)
+    q->t[(q->head + q->n++) % q->size] = time;
+}
+
+/* B delivered n messages of the current connection */
+void latency_delivered(int n)
+{
+  struct sendtimes *q;
+  float *l;
+
+  if (!latencyon)
+    return;
+  q = &sendtimes[connection];
+  for (; n > 0 && q->n > 0; n--) {
+    if (nlatencies == latencysize) {
+      latencysize = latencysize ? 2 * latencysize : 1024;
+      l = realloc(latencies, latencysize * sizeof(float));
+      if (l == NULL) {
+        printf("memory allocation for latency failed.");
+        exit(EXIT_FAILURE);
+      }
+      latencies = l;
+    }
+    latencies[nlatencies++] = time - q->t[q->head];
+    q->head = (q->head + 1) % q->size;
+    q->n--;
+  }
+}
+
+static int floatcmp(const void *a, const void *b)
+{
+  float x = *(const float *)a, y = *(const float *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* mean, median, tail and maximum of the latencies */
+void latency_report(FILE *fp)
+{
+  double sum = 0;
+  long i;
+
+  if (!latencyon || nlatencies == 0)
+    return;
+  qsort(latencies, nlatencies, sizeof(float), floatcmp);
+  for (i=0; i<nlatencies; i++)
+    sum += latencies[i];
+  fprintf(fp, "delivery latency over %ld messages:  mean %f, median %f, 95%% %f, 99%% %f, max %f \n",
+          nlatencies, sum / nlatencies, latencies[nlatencies / 2],
+          latencies[(long)(nlatencies * 0.95)], latencies[(long)(nlatencies * 0.99)],
+          latencies[nlatencies - 1]);
+}
+
+/********************** MULTIPATH ***********************/
+/*  With --path the medium is made of several paths.  Each packet goes     */
+/*  out on the path the scheduler of its sender picks and is numbered in   */
+/*  the order its connection sent it; at the other side a resequencer      */
+/*  hands the packets to the protocol in that order, so that striping      */
+/*  does not look like loss to it.  Every path keeps its own packets in    */
+/*  order, and a packet lost on its path is given up when it would have    */
+/*  arrived, as a receiver does once the next packet on that path is in.   */
+/**************************************************************************/
+
+void multipath_init(void)
+{
+  int AorB, p;
+
+  for (p=0; p<npaths; p++)
+    for (AorB=A; AorB<=B; AorB++) {
+      paths[p].ch[AorB].rng = &rng;
+      if (corruptdirection == (AorB+1) % 2) {
+        paths[p].ch[AorB].lossprob = 0;
+        paths[p].ch[AorB].corruptprob = 0;
+      }
+      else {
+        paths[p].ch[AorB].lossprob = paths[p].lossprob;
+        paths[p].ch[AorB].corruptprob = paths[p].corruptprob;
+      }
+      paths[p].ch[AorB].delay = paths[p].delay;
+      paths[p].ch[AorB].model = CHANNEL_BERNOULLI;
+      paths[p].ch[AorB].skip = skipsampling;
+      /* start from the delay the path was given */
+      paths[p].delayest[AorB] = paths[p].delay > 0 ? paths[p].delay : CHANNEL_MEANDELAY;
+    }
+  for (AorB=A; AorB<=B; AorB++) {
+    pathlast[AorB] = calloc((size_t)nconnections * npaths, sizeof(float));
+    reseq[AorB] = calloc(nconnections, sizeof(struct resequencer));
+    if (pathlast[AorB] == NULL || reseq[AorB] == NULL) {
+      printf("memory allocation for paths failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* fork a run of the simulation over each path alone, to compare the
+   goodput of the multipath run with */
+void multipath_fork(void)
+{
+  int fd[2], p;
+  pid_t pid;
+
+  fflush(stdout);
+  for (p=0; p<npaths; p++) {
+    if (pipe(fd) < 0) {
+      perror("pipe");
+      exit(EXIT_FAILURE);
+    }
+    pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+      close(fd[0]);
+      alone = p;
+      alonefd[p] = fd[1];
+      TRACE = 0;
+      return;
+    }
+    close(fd[1]);
+    alonefd[p] = fd[0];
+  }
+}
+
+/* messages delivered per time unit */
+double goodput(void)
+{
+  return time > 0 ? messages_delivered / time : 0;
+}
+
+/* a comparison run is over: hand its goodput to the multipath run */
+void multipath_alone_done(void)
+{
+  double g = goodput();
+
+  if (write(alonefd[alone], &g, sizeof g) != sizeof g)
+    perror("write");
+  exit(EXIT_SUCCESS);
+}
+
+/* path for the next packet AorB sends */
+int pickpath(int AorB)
+{
+  float best, w, total;
+  int p, pick;
+
+  if (alone >= 0)
+    return alone;
+  pick = 0;
+  switch (scheduler) {
+  case SCHED_RTT:
+    /* the sender knows how long the packets it has on a path still take
+       and, from the arrivals, how long a packet takes after them */
+    best = FLT_MAX;
+    for (p=0; p<npaths; p++) {
+      w = pathlast[(AorB+1) % 2][connection * npaths + p] - time;
+      w = (w > 0 ? w : 0) + paths[p].delayest[AorB];
+      if (w < best) {
+        best = w;
+        pick = p;
+      }
+    }
+    break;
+  case SCHED_LOSS:
+    /* smooth weighted round-robin: each path earns credit in proportion
+       to the share of its packets that get through, and the richest
+       path sends and pays for it */
+    total = 0;
+    best = -FLT_MAX;
+    for (p=0; p<npaths; p++) {
+      w = 1 - paths[p].lossest[AorB];
+      total += w;
+      paths[p].credit[AorB] += w;
+      if (paths[p].credit[AorB] > best) {
+        best = paths[p].credit[AorB];
+        pick = p;
+      }
+    }
+    paths[pick].credit[AorB] -= total;
+    break;
+  default:
+    pick = nextpath[AorB];
+    nextpath[AorB] = (pick + 1) % npaths;
+  }
+  return pick;
+}
+
+/* evptr carries a packet AorB sends on path p, lost or not */
+void multipath_sent(struct event *evptr, int AorB, int p, float lastime, int lost)
+{
+  struct resequencer *r = &reseq[evptr->eventity][connection];
+
+  evptr->path = p;
+  evptr->pathseq = r->sent++;
+  evptr->sent = time;
+  evptr->start = lastime;
+  paths[p].sent[AorB]++;
+  paths[p].lost[AorB] += lost;
+  paths[p].lossest[AorB] += PATHGAIN * (lost - paths[p].lossest[AorB]);
+}
+
+/* the packet AorB sent on path p is lost: the other side learns it when
+   the packet would have arrived */
+void multipath_lost(int AorB, int p, float lastime)
+{
+  struct event *evptr;
+
+  evptr = newevent();
+  evptr->evtype = FROM_LAYER3;
+  evptr->eventity = (AorB+1) % 2;
+  evptr->conn = connection;
+  evptr->pktptr = NULL;
+  multipath_sent(evptr, AorB, p, lastime, 1);
+  evptr->evtime = channel_arrival(&paths[p].ch[AorB], lastime);
+  insertevent(evptr);
+}
+
+/* hand a packet that arrived to entity AorB */
+void deliver_packet(int AorB, struct pkt *packet)
+{
+  struct pkt pkt2give;
+  int i;
+
+  pkt2give.seqnum = packet->seqnum;
+  pkt2give.acknum = packet->acknum;
+  pkt2give.checksum = packet->checksum;
+  for (i=0; i<20; i++)
+    pkt2give.payload[i] = packet->payload[i];
+  if (AorB == A)               /* deliver packet by calling */
+    A_input(pkt2give);         /* appropriate entity */
+  else
+    B_input(pkt2give);
+  free(packet);                /* free the memory for packet */
+}
+
+/* a packet arrives, or is found lost, at the end of its path */
+void multipath_arrival(struct event *evptr)
+{
+  struct resequencer *r = &reseq[evptr->eventity][evptr->conn];
+  struct path *p = &paths[evptr->path];
+  int from = (evptr->eventity+1) % 2;
+  struct pkt **slot, *packet;
+  unsigned long k;
+  int size;
+
+  if (evptr->pktptr != NULL) {
+    p->arrived[from]++;
+    p->delaysum[from] += time - evptr->sent;
+    p->delayest[from] += PATHGAIN * (time - evptr->start - p->delayest[from]);
+  }
+  else if (TRACE>0)
+    printf("          FROM_LAYER3: packet lost on path %d given up\n", evptr->path);
+
+  if (evptr->pathseq - r->next >= (unsigned long)r->size) {
+    for (size = r->size ? r->size : 16; evptr->pathseq - r->next >= (unsigned long)size; size *= 2)
+      ;
+    slot = calloc(size, sizeof(struct pkt *));
+    if (slot == NULL) {
+      printf("memory allocation for paths failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (k=r->next; k<r->next+r->size; k++)
+      slot[k & (size-1)] = r->slot[k & (r->size-1)];
+    free(r->slot);
+    r->slot = slot;
+    r->size = size;
+  }
+  r->slot[evptr->pathseq & (r->size-1)] = evptr->pktptr ? evptr->pktptr : &lostmark;
+
+  while ((packet = r->slot[r->next & (r->size-1)]) != NULL) {
+    r->slot[r->next & (r->size-1)] = NULL;
+    r->next++;
+    if (packet != &lostmark)
+      deliver_packet(evptr->eventity, packet);
+  }
+}
+
+/* the goodput of the multipath run against each path alone */
+void multipath_report(FILE *fp)
+{
+  static const char *names[] = { "round-robin", "earliest arrival", "loss-weighted" };
+  double g[MAXPATHS];
+  long sent = 0;
+  int p, best;
+
+  for (p=0; p<npaths; p++)
+    sent += paths[p].sent[A];
+
+  fprintf(fp, "multipath over %d paths, %s scheduler:  goodput %f messages per time unit \n",
+          npaths, names[scheduler], goodput());
+  best = -1;
+  for (p=0; p<npaths; p++) {
+    g[p] = -1;
+    if (npaths > 1 && read(alonefd[p], &g[p], sizeof g[p]) != sizeof g[p])
+      g[p] = -1;
+    if (g[p] >= 0 && (best < 0 || g[p] > g[best]))
+      best = p;
+    fprintf(fp, "  path %d (loss %g, corruption %g, delay %g):  A sent %ld (%.1f%%), lost %ld, mean delay %f; B sent %ld, lost %ld",
+            p, paths[p].lossprob, paths[p].corruptprob,
+            paths[p].delay > 0 ? paths[p].delay : CHANNEL_MEANDELAY,
+            paths[p].sent[A], sent ? 100.0 * paths[p].sent[A] / sent : 0,
+            paths[p].lost[A],
+            paths[p].arrived[A] ? paths[p].delaysum[A] / paths[p].arrived[A] : 0,
+            paths[p].sent[B], paths[p].lost[B]);
+    if (g[p] >= 0)
+      fprintf(fp, "; alone goodput %f", g[p]);
+    fprintf(fp, " \n");
+  }
+  if (best >= 0)
+    fprintf(fp, "best single path:  %d, goodput %f; multipath gives %.2f times that \n",
+            best, g[best], g[best] > 0 ? goodput() / g[best] : 0);
+}
+
+/* parse the argument of --path, 0 if it is not valid */
+int parse_path(const char *arg)
+{
+  struct path *p = &paths[npaths];
+
+  if (npaths == MAXPATHS)
+    return 0;
+  p->delay = 0;
+  if (sscanf(arg, "%f,%f,%f", &p->lossprob, &p->corruptprob, &p->delay) < 2
+      || p->lossprob < 0 || p->lossprob > 1 || p->corruptprob < 0 || p->corruptprob > 1
+      || p->delay < 0)
+    return 0;
+  npaths++;
+  return 1;
+}
+
+/********************** LAYER 5 ***********************/
+
+/* the next message from layer 5 */
+void make_message(struct msg *msg2give)
+{
+  int i, j;
+
+  /* fill in msg to give with string of same letter */    
+  j = nsim % 26; 
+  for (i=0; i<20; i++)  
+    msg2give->data[i] = 97 + j;
+  if (TRACE>2) {
+    printf("          MAINLOOP: data given to student: ");
+    for (i=0; i<20; i++) 
+      printf("%c", msg2give->data[i]);
+    printf("\n");
+  }
+  nsim++;
+}
+
+/* pass the next message from layer 5 to entity */
+void give_message(int entity)
+{
+  struct msg msg2give;
+
+  make_message(&msg2give);
+  if (entity == A) 
+    latency_sent(A_output_batch(&msg2give, 1));
+  else
+    B_output(msg2give);  
+}
+
+/* the saturating source keeps the current connection's window full,
+   handing over all the messages that fit in one call */
+void saturate(void)
+{
+  struct msg msgs[64];
+  int i, n;
+
+  while ((n = A_windowopen()) > 0 && nsim < nsimmax) {
+    if (n > nsimmax - nsim)
+      n = nsimmax - nsim;
+    if (n > 64)
+      n = 64;
+    for (i=0; i<n; i++)
+      make_message(&msgs[i]);
+    latency_sent(A_output_batch(msgs, n));
+  }
+}
+
+/* parse the argument of --source, 0 if it is not valid */
+int parse_source(const char *arg)
+{
+  paretoshape = 1.5;
+  if (strcmp(arg, "uniform") == 0)
+    source = SRC_UNIFORM;
+  else if (strcmp(arg, "poisson") == 0)
+    source = SRC_POISSON;
+  else if (strcmp(arg, "saturate") == 0)
+    source = SRC_SATURATE;
+  else if (strncmp(arg, "onoff:", 6) == 0) {
+    source = SRC_ONOFF;
+    if (sscanf(arg + 6, "%f,%f,%f", &onmean, &offmean, &paretoshape) < 2)
+      return 0;
+    if (onmean <= 0 || offmean < 0 || paretoshape <= 1)
+      return 0;
+  }
+  else if (strncmp(arg, "trace:", 6) == 0) {
+    source = SRC_TRACE;
+    if (strlen(arg + 6) >= sizeof sourcefile)
+      return 0;
+    strcpy(sourcefile, arg + 6);
+  }
+  else
+    return 0;
+  return 1;
+}
+
+/********************** TIME SERIES SAMPLING ***********************/
+
+/* Samples are kept column by column in arrays sized up front for the
+   expected length of the run.  A binary sample file is a struct
+   sampleheader followed by each column in turn, count values of 4 bytes
+   each, in the order of the struct samples members. */
+#define SAMPLEMAGIC   0x4c504d53   /* "SMPL" */
+#define SAMPLEVERSION 1
+
+struct sampleheader {
+  unsigned int magic;
+  unsigned int version;
+  unsigned long long count;     /* samples in each column */
+  float interval;               /* time units between samples */
+  unsigned int ncolumns;
+};
+
+struct samples {
+  int n, size;
+  float *time;                  /* simulated time of the sample */
+  int *windowcount;             /* packets awaiting an ACK at A */
+  int *inflight;                /* packets in the medium, both directions */
+  float *backlog;               /* time until the medium towards B drains */
+  int *delivered;               /* messages delivered to layer 5 so far */
+  int *resent;                  /* packets resent by A so far */
+};
+static struct samples samples;
+
+static void *samplecolumn(void *old, int size)
+{
+  void *p;
+
+  p = realloc(old, size * 4);
+  if (p == NULL) {
+    printf("memory allocation for samples failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void samplealloc(int size)
+{
+  samples.size = size;
+  samples.time = samplecolumn(samples.time, size);
+  samples.windowcount = samplecolumn(samples.windowcount, size);
+  samples.inflight = samplecolumn(samples.inflight, size);
+  samples.backlog = samplecolumn(samples.backlog, size);
+  samples.delivered = samplecolumn(samples.delivered, size);
+  samples.resent = samplecolumn(samples.resent, size);
+}
+
+/* start sampling from the current time */
+void sample_init(void)
+{
+  double expected;
+
+  if (sampleinterval <= 0)
+    return;
+  /* messages arrive every lambda time units on average */
+  expected = ((double)nsimmax * lambda - time) / sampleinterval;
+  samplealloc(expected < 1024 ? 1024 : expected > (1 << 24) ? (1 << 24) : (int)expected + 1024);
+  nextsampleno = (long)(time / sampleinterval);
+  if (nextsampleno * sampleinterval < time)
+    nextsampleno++;
+  nextsample = nextsampleno * sampleinterval;
+}
+
+/* record the state at every sample time up to upto; the state does not
+   change between events */
+void take_samples(float upto)
+{
+  int n;
+
+  while (nextsample <= upto) {
+    if (samples.n == samples.size)
+      samplealloc(2 * samples.size);
+    n = samples.n++;
+    samples.time[n] = nextsample;
+    samples.windowcount[n] = A_windowcount();
+    samples.inflight[n] = inflight;
+    samples.backlog[n] = latestarrival[B] > nextsample ? latestarrival[B] - nextsample : 0;
+    samples.delivered[n] = messages_delivered;
+    samples.resent[n] = packets_resent;
+    nextsample = ++nextsampleno * sampleinterval;
+  }
+}
+
+void write_samples(void)
+{
+  struct sampleheader h;
+  char name[300];
+  FILE *fp;
+  int i, ok;
+
+  if (sampleinterval <= 0)
+    return;
+  if (variant >= 0)
+    snprintf(name, sizeof name, "%s.variant%d", samplefile, variant);
+  else
+    snprintf(name, sizeof name, "%s", samplefile);
+  fp = fopen(name, samplebinary ? "wb" : "w");
+  if (fp == NULL) {
+    perror(name);
+    return;
+  }
+  if (samplebinary) {
+    memset(&h, 0, sizeof h);
+    h.magic = SAMPLEMAGIC;
+    h.version = SAMPLEVERSION;
+    h.count = samples.n;
+    h.interval = sampleinterval;
+    h.ncolumns = 6;
+    ok = fwrite(&h, sizeof h, 1, fp) == 1
+      && fwrite(samples.time, 4, samples.n, fp) == (size_t)samples.n
+      && fwrite(samples.windowcount, 4, samples.n, fp) == (size_t)samples.n
+      && fwrite(samples.inflight, 4, samples.n, fp) == (size_t)samples.n
+      && fwrite(samples.backlog, 4, samples.n, fp) == (size_t)samples.n
+      && fwrite(samples.delivered, 4, samples.n, fp) == (size_t)samples.n
+      && fwrite(samples.resent, 4, samples.n, fp) == (size_t)samples.n;
+  }
+  else {
+    ok = fprintf(fp, "time,windowcount,inflight,backlog,delivered,resent\n") > 0;
+    for (i=0; ok && i<samples.n; i++)
+      ok = fprintf(fp, "%f,%d,%d,%f,%d,%d\n", samples.time[i], samples.windowcount[i],
+                   samples.inflight[i], samples.backlog[i], samples.delivered[i],
+                   samples.resent[i]) > 0;
+  }
+  if (fclose(fp) != 0 || !ok)
+    perror(name);
+}
+
 /********************** Student-callable ROUTINES ***********************/
 
 /* called by students routine to cancel a previously-started timer */
@@ -239,25 +1770,12 @@ void stoptimer(int AorB)
 
   if (TRACE>1)
     printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
+  q = timers[AorB][connection];
+  if (q != NULL) {
+    removeevent(q);
+    freeevent(q);
+    return;
+  }
   printf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
@@ -265,31 +1783,22 @@ void stoptimer(int AorB)
 void starttimer(int AorB, double increment)
 /* A or B is trying to start timer */
 {
-
-  struct event *q;
   struct event *evptr;
 
   if (TRACE>1)
     printf("          START TIMER: starting timer at %f\n",time);
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
+  if (timers[AorB][connection] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  evptr = newevent();
   evptr->evtime =  time + increment;
   evptr->evtype =  TIMER_INTERRUPT;
-   
- 
   evptr->eventity = AorB;
+  evptr->conn = connection;
   insertevent(evptr);
 } 
 
@@ -299,17 +1808,30 @@ void tolayer3(int AorB, struct pkt packet)
 /* A or B is sending to network  */
 {
   struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
+  struct event *evptr;
+  struct channel *ch;
+  float lastime, *last;
+  int i, path;
 
   ntolayer3++;
 
+  /* the medium, or the path the scheduler picks */
+  path = -1;
+  ch = &channels[AorB];
+  last = &lastarrival[(AorB+1) % 2][connection];
+  if (npaths > 0) {
+    path = pickpath(AorB);
+    ch = &paths[path].ch[AorB];
+    last = &pathlast[(AorB+1) % 2][connection * npaths + path];
+  }
+
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+  if (channel_lost(ch)) {
     nlost++;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being lost\n");
+    if (path >= 0)
+      multipath_lost(AorB, path, *last > time ? *last : time);
     return;
   }  
 
@@ -334,80 +1856,385 @@ void tolayer3(int AorB, struct pkt packet)
   }
 
   /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  evptr = newevent();
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
+  evptr->conn = connection;
   evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
+     currently in the medium on their way to the destination.  All
+     connections share the channel's loss, corruption and delay, but
+     each keeps its own packets in order: one connection's packets do
+     not queue behind another's.  With several paths each path keeps
+     the connection's packets in order. */
   lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
- 
-
+  if (*last > lastime)
+    lastime = *last;
+  evptr->evtime = channel_arrival(ch, lastime);
+  *last = evptr->evtime;
+  if (path >= 0)
+    multipath_sent(evptr, AorB, path, lastime, 0);
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
+  if (channel_corrupt(ch, mypktptr)) {
     ncorrupt++;
-    if ( (x = jimsrand()) < .75)
-      mypktptr->payload[0]='Z';   /* corrupt payload */
-    else if (x < .875)
-      mypktptr->seqnum = 999999;
-    else
-      mypktptr->acknum = 999999;
     if (TRACE>0)    
       printf("          TOLAYER3: packet being corrupted\n");
   }  
 
   if (TRACE>2)  
     printf("          TOLAYER3: scheduling arrival on other side\n");
+  if (evptr->evtime > latestarrival[evptr->eventity])
+    latestarrival[evptr->eventity] = evptr->evtime;
+  inflight++;
   insertevent(evptr);
 } 
 
+void tolayer5_batch(int AorB, const struct msg *msgs, int n)
+{
+  int i, k;
+  if (TRACE>2)
+    for (k=0; k<n; k++) {
+      printf("          TOLAYER5: data received by application at ");
+      if (AorB == A) 
+        printf("A: ");
+      else
+        printf("B: ");
+      for (i=0; i<20; i++)  
+        printf("%c",msgs[k].data[i]);
+      printf("\n");
+    }
+  messages_delivered += n;
+  if (AorB == B)
+    latency_delivered(n);
+}
+
 void tolayer5(int AorB, char datasent[20])
 {
-  int i;  
-  if (TRACE>2) {
-    printf("          TOLAYER5: data received by application at ");
-    if (AorB == A) 
-      printf("A: ");
-    else
-      printf("B: ");
-    for (i=0; i<20; i++)  
-      printf("%c",datasent[i]);
-    printf("\n");
+  struct msg message;
+
+  memcpy(message.data, datasent, 20);
+  tolayer5_batch(AorB, &message, 1);
+}
+
+/* print the end of run statistics in one piece, so that the reports of
+   forked variants do not interleave */
+void report(void)
+{
+  struct timeval now;
+  double elapsed;
+  char *buf;
+  size_t len;
+  FILE *fp;
+
+  fp = open_memstream(&buf, &len);
+  if (fp == NULL) {
+    perror("open_memstream");
+    exit(EXIT_FAILURE);
+  }
+  if (variant >= 0)
+    fprintf(fp, "----- variant %d: loss %f, corruption %f -----\n", variant, lossprob, corruptprob);
+  else if (nvariants > 0)
+    fprintf(fp, "----- base run: loss %f, corruption %f -----\n", lossprob, corruptprob);
+  fprintf(fp, " Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
+  fprintf(fp, "number of messages dropped due to full window:  %d \n", window_full);
+  fprintf(fp, "number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  fprintf(fp, "(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  fprintf(fp, "number of packet resends by A:  %d \n", packets_resent);
+  fprintf(fp, "number of correct packets received at B:  %d \n", packets_received);
+  fprintf(fp, "number of messages delivered to application:  %d \n", messages_delivered);
+  if (channels[A].model != CHANNEL_BERNOULLI || channels[B].model != CHANNEL_BERNOULLI
+      || skipsampling) {
+    fprintf(fp, "number of packets sent into the medium:  %d, lost: %d, corrupted: %d \n",
+            ntolayer3, nlost, ncorrupt);
+    fprintf(fp, "random numbers drawn by the medium:  %lu (%.3f per packet)\n",
+            channels[A].draws + channels[B].draws,
+            ntolayer3 ? (channels[A].draws + channels[B].draws) / (double)ntolayer3 : 0);
   }
-  messages_delivered++;
+#if FEC
+  fprintf(fp, "FEC parity packets sent:  %d (%.1f%% of data packets), packets rebuilt at B:  %d \n",
+          fec_parity, fec_sent ? 100.0 * fec_parity / fec_sent : 0, fec_rebuilt);
+#endif
+  latency_report(fp);
+  if (npaths > 0)
+    multipath_report(fp);
+  if (nconnections > 1) {
+    gettimeofday(&now, NULL);
+    elapsed = (now.tv_sec - starttime.tv_sec) + (now.tv_usec - starttime.tv_usec) / 1e6;
+    fprintf(fp, "number of connections:  %d \n", nconnections);
+    fprintf(fp, "memory per connection:  %lu bytes (protocol %lu, emulator %lu)\n",
+            (unsigned long)(connection_state_size() + 2 * (sizeof(struct event *) + sizeof(float))),
+            (unsigned long)connection_state_size(),
+            (unsigned long)(2 * (sizeof(struct event *) + sizeof(float))));
+    fprintf(fp, "events simulated:  %ld in %.3f s (%.0f events/s)\n",
+            nsimulated, elapsed, elapsed > 0 ? nsimulated / elapsed : 0);
+  }
+  fclose(fp);
+  fflush(stdout);
+  if (write(STDOUT_FILENO, buf, len) < 0)
+    perror("write");
+  free(buf);
+}
+
+void usage(const char *prog)
+{
+  printf("usage: %s [options]\n", prog);
+  printf("  --save <file>        write a snapshot of the simulation to file\n");
+  printf("  --at <time>          take the snapshot at this simulated time\n");
+  printf("  --on-full            take the snapshot when the send window first fills\n");
+  printf("  --restore <file>     start from a snapshot instead of prompting for settings\n");
+  printf("  --variant <l>,<c>    at the snapshot point fork a run with loss l and corruption c\n");
+  printf("  --connections <n>    run n connections over the shared channel (default 1)\n");
+  printf("  --gilbert-ab <p>,<r>,<lg>,<lb>\n");
+  printf("                       bursty loss from A to B: p good->bad, r bad->good,\n");
+  printf("                       loss probability lg when good and lb when bad\n");
+  printf("  --gilbert-ba <p>,<r>,<lg>,<lb>\n");
+  printf("                       the same from B to A\n");
+  printf("  --replay-ab <file>   take loss, delay and corruption from A to B from a trace\n");
+  printf("  --replay-ba <file>   the same from B to A\n");
+  printf("  --sample <t>         sample the window, packets in flight, backlog,\n");
+  printf("                       deliveries and resends every t time units\n");
+  printf("  --sample-file <file> write the samples to file (default samples.csv)\n");
+  printf("  --sample-binary      write them as binary columns instead of CSV\n");
+  printf("  --skip-sampling      draw the number of packets until the next loss or\n");
+  printf("                       corruption rather than deciding every packet\n");
+  printf("  --source <s>         how messages arrive from layer 5 (mean gap lambda):\n");
+  printf("                       uniform      uniform on [0,2*lambda] (default)\n");
+  printf("                       poisson      exponential gaps\n");
+  printf("                       onoff:<on>,<off>[,<shape>]\n");
+  printf("                                    Poisson during ON periods; ON and OFF\n");
+  printf("                                    lengths are Pareto with the given means\n");
+  printf("                                    and shape (default 1.5)\n");
+  printf("                       trace:<file> at the times listed in file\n");
+  printf("                       saturate     whenever the window has room\n");
+  printf("                                    (with gbn.c's defaults the window\n");
+  printf("                                    outlasts the timer and a saturated\n");
+  printf("                                    run may never end: add --until)\n");
+  printf("  --until <t>          end the simulation at time t\n");
+  printf("  --latency            report the time from layer 5 at A to layer 5 at B\n");
+  printf("  --path <l>,<c>[,<d>] add a path with loss l, corruption c and mean delay d\n");
+  printf("                       (default 5.5); packets are striped over the paths and\n");
+  printf("                       reordered before the protocol sees them, and the goodput\n");
+  printf("                       is compared with runs over each path alone\n");
+  printf("  --scheduler <s>      how A and B pick a path: rr round-robin (default), rtt\n");
+  printf("                       earliest expected arrival, loss weighted by delivery rate\n");
+  printf("  --seed <n>           seed of the random number stream (default 9999)\n");
+  printf("  --delay <t>          mean delay of the medium (default 5.5)\n");
+  printf("  --replicate <r>      run with seed, seed+1, ... until the 95%% confidence\n");
+  printf("                       intervals of the mean goodput, resends and full window\n");
+  printf("                       drops are within r times the mean (say 0.05)\n");
+  printf("  --jobs <n>           replicates at a time (default one per CPU)\n");
+  printf("  --max-replicates <n> stop after n replicates (default 1000)\n");
+  printf("  --replicate-file <file>\n");
+  printf("                       write each replicate's results to file as it ends\n");
+  printf("                       (default replicates.csv)\n");
+  exit(EXIT_FAILURE);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+  static struct option options[] = {
+    {"save",     required_argument, NULL, 's'},
+    {"at",       required_argument, NULL, 't'},
+    {"on-full",  no_argument,       NULL, 'f'},
+    {"restore",  required_argument, NULL, 'r'},
+    {"variant",  required_argument, NULL, 'v'},
+    {"connections", required_argument, NULL, 'C'},
+    {"gilbert-ab", required_argument, NULL, 'g'},
+    {"gilbert-ba", required_argument, NULL, 'G'},
+    {"replay-ab", required_argument, NULL, 'p'},
+    {"replay-ba", required_argument, NULL, 'P'},
+    {"sample", required_argument, NULL, 'i'},
+    {"sample-file", required_argument, NULL, 'o'},
+    {"sample-binary", no_argument, NULL, 'b'},
+    {"skip-sampling", no_argument, NULL, 'k'},
+    {"source", required_argument, NULL, 'w'},
+    {"latency", no_argument, NULL, 'L'},
+    {"path", required_argument, NULL, 'm'},
+    {"scheduler", required_argument, NULL, 'S'},
+    {"seed", required_argument, NULL, 'e'},
+    {"delay", required_argument, NULL, 'D'},
+    {"until", required_argument, NULL, 'U'},
+    {"replicate", required_argument, NULL, 'R'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"max-replicates", required_argument, NULL, 'x'},
+    {"replicate-file", required_argument, NULL, 'F'},
+    {NULL, 0, NULL, 0}
+  };
   struct event *eventptr;
-  struct msg  msg2give;
-  struct pkt  pkt2give;
-   
-  int i,j;
-  
-  init();
-  A_init();
-  B_init();
+  int i,c;
+
+  while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (c) {
+    case 's':
+      savefile = optarg;
+      break;
+    case 't':
+      snaptime = atof(optarg);
+      break;
+    case 'f':
+      snaponfull = 1;
+      break;
+    case 'r':
+      restorefile = optarg;
+      break;
+    case 'v':
+      if (nvariants == MAXVARIANTS ||
+          sscanf(optarg, "%f,%f", &variantloss[nvariants], &variantcorrupt[nvariants]) != 2)
+        usage(argv[0]);
+      nvariants++;
+      break;
+    case 'C':
+      nconnections = atoi(optarg);
+      if (nconnections < 1)
+        usage(argv[0]);
+      break;
+    case 'g':
+    case 'G':
+      i = c == 'g' ? A : B;
+      if (sscanf(optarg, "%f,%f,%f,%f", &gilbert[i].p, &gilbert[i].r,
+                 &gilbert[i].lossgood, &gilbert[i].lossbad) != 4)
+        usage(argv[0]);
+      gilberton[i] = 1;
+      break;
+    case 'p':
+    case 'P':
+      i = c == 'p' ? A : B;
+      if (strlen(optarg) >= sizeof replayfile[i])
+        usage(argv[0]);
+      strcpy(replayfile[i], optarg);
+      break;
+    case 'i':
+      sampleinterval = atof(optarg);
+      if (sampleinterval <= 0)
+        usage(argv[0]);
+      break;
+    case 'o':
+      samplefile = optarg;
+      break;
+    case 'b':
+      samplebinary = 1;
+      break;
+    case 'k':
+      skipsampling = 1;
+      break;
+    case 'w':
+      if (!parse_source(optarg))
+        usage(argv[0]);
+      break;
+    case 'L':
+      latencyon = 1;
+      break;
+    case 'm':
+      if (!parse_path(optarg))
+        usage(argv[0]);
+      break;
+    case 'e':
+      seed = strtoul(optarg, NULL, 10);
+      break;
+    case 'D':
+      delay = atof(optarg);
+      if (delay <= 0)
+        usage(argv[0]);
+      break;
+    case 'U':
+      until = atof(optarg);
+      if (until <= 0)
+        usage(argv[0]);
+      break;
+    case 'R':
+      replicateprecision = atof(optarg);
+      if (replicateprecision <= 0)
+        usage(argv[0]);
+      break;
+    case 'j':
+      replicatejobs = atoi(optarg);
+      if (replicatejobs < 1)
+        usage(argv[0]);
+      break;
+    case 'x':
+      maxreplicates = atoi(optarg);
+      if (maxreplicates < MINREPLICATES)
+        usage(argv[0]);
+      break;
+    case 'F':
+      replicatefile = optarg;
+      break;
+    case 'S':
+      if (strcmp(optarg, "rr") == 0)
+        scheduler = SCHED_RR;
+      else if (strcmp(optarg, "rtt") == 0)
+        scheduler = SCHED_RTT;
+      else if (strcmp(optarg, "loss") == 0)
+        scheduler = SCHED_LOSS;
+      else
+        usage(argv[0]);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  /* the accept times of messages in flight are not in a snapshot, nor
+     is the state of the paths; the paths lose packets independently */
+  if (optind < argc || (latencyon && restorefile != NULL))
+    usage(argv[0]);
+  if (npaths > 0 && (savefile != NULL || restorefile != NULL || nvariants > 0
+                     || gilberton[A] || gilberton[B] || replayfile[A][0] || replayfile[B][0]))
+    usage(argv[0]);
+  /* replicates start from the settings, each writing its own results */
+  if (replicateprecision > 0 && (savefile != NULL || restorefile != NULL || nvariants > 0
+                                 || sampleinterval > 0))
+    usage(argv[0]);
+  if (replicatejobs == 0)
+    replicatejobs = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  openreplays();
+  if (source == SRC_TRACE)
+    loadarrivals();
+  if (samplefile == NULL)
+    samplefile = samplebinary ? "samples.bin" : "samples.csv";
+
+  if (restorefile != NULL) {
+    if (!snapshot_restore(restorefile))
+      exit(EXIT_FAILURE);
+    /* without another trigger the restored state is the branch point */
+    if (snaptime < 0 && !snaponfull)
+      checkpoint();
+  }
+  else {
+    init();
+    if (npaths > 0) {
+      multipath_init();
+      if (npaths > 1 && replicatefd < 0)
+        multipath_fork();
+    }
+    latency_init();
+    A_init();
+    B_init();
+    if (source == SRC_SATURATE)
+      for (connection=0; connection<nconnections; connection++)
+        saturate();
+  }
+  sample_init();
+  gettimeofday(&starttime, NULL);
    
   while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
+    eventptr = firstevent();
+    if (eventptr == NULL)
       goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
+    if (until > 0 && eventptr->evtime > until) {
+      time = until;
+      goto terminate;
+    }
+    if (eventptr->evtime >= nextsample)
+      take_samples(eventptr->evtime);
+    if (!snaptaken && snaptime >= 0 && eventptr->evtime >= snaptime) {
+      time = snaptime;
+      checkpoint();
+    }
+    eventptr = popevent();        /* get next event to simulate */
+    nsimulated++;
     if (TRACE>=2) {
       printf("\nEVENT time: %f,",eventptr->evtime);
       printf("  type: %d",eventptr->evtype);
@@ -420,39 +2247,22 @@ int main(void)
       printf(" entity: %d\n",eventptr->eventity);
     }
     time = eventptr->evtime;        /* update time to next event time */
+    connection = eventptr->conn;
     if (eventptr->evtype == FROM_LAYER5 ) {
       if (nsim < nsimmax) {
         generate_next_arrival();   /* set up future arrival */
-        /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
-        for (i=0; i<20; i++)  
-          msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
-          printf("          MAINLOOP: data given to student: ");
-          for (i=0; i<20; i++) 
-            printf("%c", msg2give.data[i]);
-          printf("\n");
-        }
-        nsim++;
-        if (eventptr->eventity == A) 
-          A_output(msg2give);  
-        else
-          B_output(msg2give);  
+        give_message(eventptr->eventity);
       }
       else if (TRACE > 2)
           printf("          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+      if (eventptr->pktptr != NULL)    /* NULL: lost on its path */
+        inflight--;
+      if (npaths > 0)
+        multipath_arrival(eventptr);
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        deliver_packet(eventptr->eventity, eventptr->pktptr);
     }
     else if (eventptr->evtype ==  TIMER_INTERRUPT) {
       if (eventptr->eventity == A) 
@@ -463,16 +2273,23 @@ int main(void)
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
     }
-    free(eventptr);
+    if (source == SRC_SATURATE && eventptr->eventity == A)
+      saturate();                  /* the window may have opened */
+    if (eventptr != &arriving)
+      freeevent(eventptr);
+    if (!snaptaken && snaponfull && A_windowopen() == 0)
+      checkpoint();               /* the connection's window has filled */
   }
 
  terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
-  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  if (alone >= 0)
+    multipath_alone_done();
+  if (replicatefd >= 0)
+    replicate_done();
+  write_samples();
+  report();
+  if (variant < 0)
+    while (wait(NULL) > 0)       /* collect the forked variants */
+      ;
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
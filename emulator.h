@@ -10,6 +10,14 @@ extern int window_full; /* count of the number of messages dropped due to full w
 #define   A    0
 #define   B    1
 
+/* several independent A/B connections can share the emulated channel.
+   Before calling A_output(), A_input(), B_input() or a timer interrupt
+   the emulator sets connection to the id (0..nconnections-1) of the
+   connection concerned, and tolayer3(), starttimer() and stoptimer() act
+   on that connection.  A_init() and B_init() set up every connection. */
+extern int nconnections;
+extern int connection;
+
 /* a "msg" is the data unit passed from layer 5 (teachers code) to layer  */
 /* 4 (students' code).  It contains the data (characters) to be delivered */
 /* to layer 5 via the students transport level protocol entities.         */
@@ -33,6 +41,9 @@ extern void tolayer3(int, struct pkt);
 /* deliver to A or B (int), data to deliver */
 extern void tolayer5(int, char[20]); 
 
+/* deliver to A or B (int) n messages at once */
+extern void tolayer5_batch(int, const struct msg *, int n);
+
 /* start timer at A or B (int), increment */
 extern void starttimer(int, double);       
 
@@ -0,0 +1,279 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "emulator.h"
+#include "fec.h"
+
+/* ******************************************************************
+   XOR parity forward error correction, used by gbn.c and sr.c when they
+   are built with -DFEC (see fec.h).
+
+   A numbers the packets it sends in groups: acknum of a data packet is
+   (group * 16 + k) * 16 + index, and after the k-th packet of a group
+   follows a parity packet with acknum (group * 16 + k) * 16 + k, seqnum
+   -2 minus the XOR of the group's sequence numbers and the XOR of their
+   payloads as payload.  Retransmissions are sent like new packets and
+   join the group being sent.
+
+   The medium keeps packets in order, so B knows a group is over when its
+   parity packet or a packet of a later group arrives.  If then exactly
+   one of its data packets is missing or corrupted it is rebuilt from the
+   others and the parity.  B estimates the share of packets lost or
+   corrupted from the groups it sees and reports it in its ACKs as a
+   percentage in payload[19] ('0' is none).
+   ********************************************************************* */
+
+#if !defined(FEC) || FEC == 0 || FEC < FECADAPTIVE || FEC > FECMAXK
+#error "build with -DFEC=k (k from 1 to FECMAXK) or -DFEC=-1 for an adaptive k"
+#endif
+
+#define TAG(group, k, index) (((group) * 16 + (k)) * 16 + (index))
+#define MAXGROUP (1 << 20)      /* group numbers wrap around here */
+#define LOSSGAIN 0.125          /* weight of the latest group in the loss estimate */
+#define MAXREPORT 50            /* largest loss percentage an ACK carries */
+
+extern int ComputeChecksum(struct pkt);
+
+int fec_sent;
+int fec_parity;
+int fec_rebuilt;
+
+/* A's group being sent */
+struct fectx {
+  int group, k, index;
+  int xorseq;                   /* XOR of the sequence numbers sent */
+  char xorpay[20];              /* and of the payloads */
+  float loss;                   /* loss last reported by B */
+};
+
+/* B's group being received */
+struct fecrx {
+  int group;                    /* -1 if none */
+  int k;
+  unsigned int mask;            /* data packets received intact */
+  int xorseq;
+  char xorpay[20];
+  float loss;                   /* share of packets lost, smoothed */
+  int nheld;                    /* packets held behind a gap */
+  struct pkt held[FECMAXK];
+};
+
+static struct fectx *tx;        /* per connection */
+static struct fecrx *rx;
+static int seqlimit;            /* no XOR of sequence numbers reaches this */
+
+void fec_init(int AorB, int seqspace)
+{
+  int c;
+
+  for (seqlimit=1; seqlimit<seqspace; seqlimit*=2)
+    ;
+
+  if (AorB == A) {
+    free(tx);
+    tx = calloc(nconnections, sizeof(struct fectx));
+  }
+  else {
+    free(rx);
+    rx = calloc(nconnections, sizeof(struct fecrx));
+  }
+  if ((AorB == A && tx == NULL) || (AorB == B && rx == NULL)) {
+    printf("memory allocation for FEC state failed.");
+    exit(EXIT_FAILURE);
+  }
+  if (AorB == B)
+    for (c=0; c<nconnections; c++)
+      rx[c].group = -1;
+}
+
+/* group size for a loss probability p: the largest k for which a group
+   and its parity lose more than one packet with at most FECTARGET, but
+   no less than 2, as sending every packet twice only adds to the loss
+   it is meant to repair on a busy medium */
+static int group_size(float p)
+{
+  double q = 1 - p, more;
+  int k;
+
+  if (FEC != FECADAPTIVE)
+    return FEC;
+  for (k=FECADAPTMAXK; k>2; k--) {
+    more = 1 - pow(q, k + 1) - (k + 1) * p * pow(q, k);
+    if (more <= FECTARGET)
+      break;
+  }
+  return k;
+}
+
+static void accumulate(int *xorseq, char *xorpay, const struct pkt *p)
+{
+  int i;
+
+  *xorseq ^= p->seqnum;
+  for (i=0; i<20; i++)
+    xorpay[i] ^= p->payload[i];
+}
+
+void fec_output(struct pkt packet)
+{
+  struct fectx *t = &tx[connection];
+  struct pkt parity;
+
+  if (t->index == 0)
+    t->k = group_size(t->loss);
+  packet.acknum = TAG(t->group, t->k, t->index);
+  packet.checksum = ComputeChecksum(packet);
+  tolayer3(A, packet);
+  fec_sent++;
+  accumulate(&t->xorseq, t->xorpay, &packet);
+  if (++t->index < t->k)
+    return;
+
+  parity.seqnum = -2 - t->xorseq;
+  parity.acknum = TAG(t->group, t->k, t->k);
+  memcpy(parity.payload, t->xorpay, 20);
+  parity.checksum = ComputeChecksum(parity);
+  if (TRACE > 1)
+    printf("----A: FEC parity for group %d of %d packets\n", t->group, t->k);
+  tolayer3(A, parity);
+  fec_parity++;
+
+  t->group = (t->group + 1) % MAXGROUP;
+  t->index = 0;
+  t->xorseq = 0;
+  memset(t->xorpay, 0, 20);
+}
+
+static int popcount(unsigned int x)
+{
+  int n = 0;
+
+  for (; x; x &= x - 1)
+    n++;
+  return n;
+}
+
+/* the group is over: count its losses and release what it held */
+static void close_group(struct fecrx *r, int parity, void (*deliver)(struct pkt))
+{
+  int lost = r->k + 1 - popcount(r->mask) - parity, i;
+
+  r->loss += LOSSGAIN * ((float)lost / (r->k + 1) - r->loss);
+  for (i=0; i<r->nheld; i++)
+    deliver(r->held[i]);
+  r->nheld = 0;
+  r->group = -1;
+}
+
+/* make the group of tag the one being received */
+static void enter_group(struct fecrx *r, int tag, void (*deliver)(struct pkt))
+{
+  if (r->group == tag >> 8)
+    return;
+  if (r->group >= 0)
+    close_group(r, 0, deliver);
+  r->group = tag >> 8;
+  r->k = (tag >> 4) & 15;
+  r->mask = 0;
+  r->xorseq = 0;
+  memset(r->xorpay, 0, 20);
+}
+
+void fec_input(struct pkt packet, void (*deliver)(struct pkt))
+{
+  struct fecrx *r = &rx[connection];
+  struct pkt rebuilt;
+  int index, missing, i;
+
+  /* leave a corrupted packet, or one A sent without FEC, to the protocol.
+     Sequence numbers outside the sequence space can only come from a
+     corrupted packet whose checksum happened to match, and must not go
+     into a rebuilt packet. */
+  if (packet.checksum != ComputeChecksum(packet) || packet.acknum < 0
+      || (packet.acknum & 15) > ((packet.acknum >> 4) & 15) || ((packet.acknum >> 4) & 15) == 0
+      || packet.seqnum >= seqlimit || -2 - packet.seqnum >= seqlimit) {
+    /* the packets held were sent before it */
+    if (packet.checksum == ComputeChecksum(packet) && r->group >= 0)
+      close_group(r, 0, deliver);
+    deliver(packet);
+    return;
+  }
+  enter_group(r, packet.acknum, deliver);
+  index = packet.acknum & 15;
+
+  if (packet.seqnum >= 0) {
+    if (index == r->k || (r->mask & (1u << index))) {
+      deliver(packet);
+      return;
+    }
+    r->mask |= 1u << index;
+    accumulate(&r->xorseq, r->xorpay, &packet);
+    /* hold it if an earlier packet of the group is still missing */
+    if (r->mask != (2u << index) - 1)
+      r->held[r->nheld++] = packet;
+    else
+      deliver(packet);
+    return;
+  }
+
+  /* a parity packet: rebuild the one missing data packet, if only one is */
+  if (index == r->k && popcount(r->mask) == r->k - 1) {
+    for (missing=0; r->mask & (1u << missing); missing++)
+      ;
+    rebuilt.seqnum = (-2 - packet.seqnum) ^ r->xorseq;
+    rebuilt.acknum = TAG(r->group, r->k, missing);
+    for (i=0; i<20; i++)
+      rebuilt.payload[i] = packet.payload[i] ^ r->xorpay[i];
+    rebuilt.checksum = ComputeChecksum(rebuilt);
+    fec_rebuilt++;
+    if (TRACE > 0)
+      printf("----B: FEC rebuilt packet %d\n", rebuilt.seqnum);
+    deliver(rebuilt);
+  }
+  close_group(r, 1, deliver);
+}
+
+void fec_stamp(struct pkt *ack)
+{
+  int percent = (int)(rx[connection].loss * 100 + 0.5);
+
+  ack->payload[19] = '0' + (percent > MAXREPORT ? MAXREPORT : percent);
+}
+
+void fec_feedback(struct pkt ack)
+{
+  int percent = ack.payload[19] - '0';
+
+  if (percent >= 0 && percent <= MAXREPORT)
+    tx[connection].loss = percent / 100.0;
+}
+
+int fec_save(int AorB, FILE *fp)
+{
+  int n = nconnections;
+
+  if (AorB == A)
+    return fwrite(tx, sizeof(struct fectx), n, fp) == (size_t)n
+        && fwrite(&fec_sent, sizeof(int), 1, fp) == 1
+        && fwrite(&fec_parity, sizeof(int), 1, fp) == 1;
+  return fwrite(rx, sizeof(struct fecrx), n, fp) == (size_t)n
+      && fwrite(&fec_rebuilt, sizeof(int), 1, fp) == 1;
+}
+
+int fec_restore(int AorB, FILE *fp)
+{
+  int n = nconnections;
+
+  if (AorB == A)
+    return fread(tx, sizeof(struct fectx), n, fp) == (size_t)n
+        && fread(&fec_sent, sizeof(int), 1, fp) == 1
+        && fread(&fec_parity, sizeof(int), 1, fp) == 1;
+  return fread(rx, sizeof(struct fecrx), n, fp) == (size_t)n
+      && fread(&fec_rebuilt, sizeof(int), 1, fp) == 1;
+}
+
+size_t fec_state_size(void)
+{
+  return sizeof(struct fectx) + sizeof(struct fecrx);
+}
@@ -0,0 +1,58 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Forward error correction between A and B.  A's data packets go out in
+   groups of k, each followed by a parity packet holding the XOR of their
+   sequence numbers and payloads, and B rebuilds any single packet of a
+   group that is lost or corrupted without waiting for A to resend it.
+
+   A protocol built with -DFEC=k (1 to FECMAXK) uses groups of k; with
+   -DFEC=-1 A picks k for every group from the loss B reports in its
+   ACKs.  A data packet carries its place in a group in acknum, which the
+   protocols do not use in data packets; a parity packet has a negative
+   seqnum. */
+
+#define FECMAXK 15              /* largest group */
+#define FECADAPTMAXK 4          /* largest group the adaptive k picks: a
+                                   packet held behind a gap waits for the
+                                   rest of its group, which must not take
+                                   longer than A's timer */
+#define FECADAPTIVE (-1)        /* value of FEC that adapts k */
+#define FECTARGET 0.05          /* adaptive k: tolerated chance of a group
+                                   losing more than one packet */
+
+/* initialise the state of A or B (int) for every connection, for a
+   protocol whose sequence numbers are 0 to seqspace - 1 */
+extern void fec_init(int, int seqspace);
+
+/* send a data packet from A, followed by a parity packet when it
+   completes a group */
+extern void fec_output(struct pkt);
+
+/* a packet arrives at B: deliver() is called for it, or for the packets
+   it releases, in the order they were sent.  Packets that follow a gap
+   in their group are held until the parity packet arrives, so that a
+   rebuilt packet is not delivered after the ones sent behind it. */
+extern void fec_input(struct pkt, void (*deliver)(struct pkt));
+
+/* B writes the loss it sees into an ACK before its checksum is
+   computed, and A reads it from an ACK that is not corrupted */
+extern void fec_stamp(struct pkt *);
+extern void fec_feedback(struct pkt);
+
+/* save and restore the state of A or B (int) and its counters, after
+   fec_init(); return 0 on error */
+extern int fec_save(int, FILE *);
+extern int fec_restore(int, FILE *);
+
+/* bytes of FEC state kept per connection */
+extern size_t fec_state_size(void);
+
+extern int fec_sent;            /* data packets sent through FEC */
+extern int fec_parity;          /* parity packets sent */
+extern int fec_rebuilt;         /* packets rebuilt at B */
+
+#endif
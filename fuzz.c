@@ -0,0 +1,375 @@
+/* ******************************************************************
+   FUZZING HARNESS
+
+   Drives the A and B entities of gbn.c or sr.c from fuzz input, in
+   process and without exec between inputs.  Every byte of the input is
+   one step: hand A a message, deliver, lose or corrupt the packet at
+   the head of one direction of the medium, or fire a timer.  The medium
+   keeps the packets of each direction in order, as the emulator does,
+   and corrupts them the way the emulator does, or forges a sequence or
+   ACK number outside the sequence space with a matching checksum.
+   When the input runs out the medium stops losing packets and the
+   harness runs until nothing is left in flight.
+
+   Invariants checked:
+   - B delivers every message A accepted, in order and exactly once;
+   - a timer is never started twice or stopped when it is not running;
+   - with -fsanitize=address,undefined, no out-of-bounds access.
+   A violation prints what happened and calls abort().
+
+   Two connections are run side by side so that the per-connection
+   state is exercised as well.
+
+   Build for libFuzzer:
+     clang -g -O1 -fsanitize=fuzzer,address,undefined -DLIBFUZZER fuzz.c gbn.c
+   for AFL++ persistent mode:
+     afl-clang-fast -O2 fuzz.c gbn.c
+   or standalone, to replay inputs or measure executions per second:
+     gcc -O2 -fsanitize=address,undefined fuzz.c gbn.c
+     ./a.out <file>...   or   ./a.out --bench <count>
+   (or sr.c instead of gbn.c; add -DFEC=<k> fec.c -lm to take the FEC
+   layer in as well).  SR's NAKs should be run with a large window too:
+     gcc -O2 -fsanitize=address,undefined -DNAK=1 -DWINDOWSIZE=32 fuzz.c sr.c
+   ********************************************************************* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "emulator.h"
+#include "gbn.h"
+
+extern int ComputeChecksum(struct pkt);
+
+#define NCONN 2                 /* connections run side by side */
+#define QSIZE 32                /* packets in flight per direction */
+#define DRAINSTEPS 100000       /* steps allowed to empty the medium */
+
+int TRACE = 0;
+
+/* statistics updated by GBN */
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+int nconnections = NCONN;
+int connection = 0;
+
+/* packets in flight from one entity to the other, oldest first */
+struct queue {
+  struct pkt pkt[QSIZE];
+  int head, n;
+};
+
+static struct queue medium[NCONN][2];   /* indexed by connection, sender */
+static int timeron[NCONN][2];
+static int accepted[NCONN];             /* messages A took for sending */
+static int delivered[NCONN];            /* messages B passed to layer 5 */
+
+static void violation(const char *what)
+{
+  printf("invariant violated on connection %d: %s (accepted %d, delivered %d)\n",
+         connection, what, accepted[connection], delivered[connection]);
+  fflush(stdout);
+  abort();
+}
+
+/* message number n of a connection; payload[0] is never 'Z', so the
+   emulator's payload corruption always changes the checksum */
+static void make_message(struct msg *m, int n)
+{
+  int i;
+
+  for (i=0; i<20; i++)
+    m->data[i] = 'a' + (n + i) % 26;
+  memcpy(&m->data[1], &n, sizeof n);
+}
+
+static int message_number(const char *data)
+{
+  int n;
+
+  memcpy(&n, &data[1], sizeof n);
+  return n;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  struct queue *q = &medium[connection][AorB];
+
+  if (q->n == QSIZE)
+    return;                     /* medium full, the packet is lost */
+  q->pkt[(q->head + q->n++) % QSIZE] = packet;
+}
+
+void tolayer5_batch(int AorB, const struct msg *msgs, int n)
+{
+  int i;
+
+  if (AorB != B)
+    violation("data delivered at A");
+  for (i=0; i<n; i++) {
+    if (delivered[connection] >= accepted[connection])
+      violation("more messages delivered than sent");
+    if (message_number(msgs[i].data) != delivered[connection])
+      violation("message delivered out of order or twice");
+    delivered[connection]++;
+  }
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  struct msg message;
+
+  memcpy(message.data, datasent, 20);
+  tolayer5_batch(AorB, &message, 1);
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (timeron[connection][AorB])
+    violation("timer started while running");
+  timeron[connection][AorB] = 1;
+}
+
+void stoptimer(int AorB)
+{
+  if (!timeron[connection][AorB])
+    violation("timer stopped while not running");
+  timeron[connection][AorB] = 0;
+}
+
+/********************** STEPS ***********************/
+
+static void offer(int c, int n)
+{
+  struct msg msgs[16];
+  int i;
+
+  connection = c;
+  for (i=0; i<n; i++)
+    make_message(&msgs[i], accepted[c] + i);
+  accepted[c] += A_output_batch(msgs, n);
+}
+
+/* take the packet at the head of the medium from sender to the other side */
+static int pop(int c, int sender, struct pkt *p)
+{
+  struct queue *q = &medium[c][sender];
+
+  if (q->n == 0)
+    return 0;
+  *p = q->pkt[q->head];
+  q->head = (q->head + 1) % QSIZE;
+  q->n--;
+  return 1;
+}
+
+static void deliver(int c, int sender, struct pkt *p)
+{
+  connection = c;
+  if (sender == A)
+    B_input(*p);
+  else
+    A_input(*p);
+}
+
+static void fire(int c, int entity)
+{
+  if (!timeron[c][entity])
+    return;
+  timeron[c][entity] = 0;
+  connection = c;
+  if (entity == A)
+    A_timerinterrupt();
+  else
+    B_timerinterrupt();
+}
+
+/* numbers no sequence space reaches */
+static const int forged[4] = { -1, 999999, -999999, 1 << 30 };
+
+/* one step: bit 0 picks the connection, bits 1-3 the action and bits 4-7
+   are its argument */
+static void step(uint8_t b)
+{
+  int c = b & 1, arg = b >> 4, dir = arg & 1;
+  struct pkt p;
+
+  switch ((b >> 1) & 7) {
+  case 0:
+    offer(c, 1);
+    break;
+  case 1:
+  case 2:
+    if (pop(c, dir, &p))
+      deliver(c, dir, &p);
+    break;
+  case 3:
+    pop(c, dir, &p);            /* lost */
+    break;
+  case 4:
+    if (pop(c, dir, &p)) {
+      /* corrupt it like the emulator does */
+      switch (arg >> 1) {
+      case 0: case 1: case 2: case 3: case 4: case 5:
+        p.payload[0] = 'Z';
+        break;
+      case 6:
+        p.seqnum = 999999;
+        break;
+      default:
+        p.acknum = 999999;
+      }
+      deliver(c, dir, &p);
+    }
+    break;
+  case 5:
+    fire(c, A);
+    break;
+  case 6:
+    if (pop(c, dir, &p)) {
+      /* a corrupted packet whose checksum still matches, with a
+         sequence or ACK number outside any sequence space */
+      if (arg & 2)
+        p.acknum = forged[arg >> 2];
+      else
+        p.seqnum = forged[arg >> 2];
+      p.checksum = ComputeChecksum(p);
+      deliver(c, dir, &p);
+    }
+    break;
+  default:
+    offer(c, arg + 1);
+  }
+}
+
+/* with no more losses, everything accepted must get through */
+static void drain(void)
+{
+  struct pkt p;
+  int c, s, steps, busy;
+
+  for (steps=0; steps<DRAINSTEPS; steps++) {
+    busy = 0;
+    for (c=0; c<NCONN; c++)
+      for (s=A; s<=B; s++)
+        if (pop(c, s, &p)) {
+          deliver(c, s, &p);
+          busy = 1;
+        }
+    if (busy)
+      continue;
+    for (c=0; c<NCONN; c++)
+      for (s=A; s<=B; s++)
+        if (timeron[c][s]) {
+          fire(c, s);
+          busy = 1;
+        }
+    if (!busy)
+      break;
+  }
+  for (c=0; c<NCONN; c++) {
+    connection = c;
+    if (steps == DRAINSTEPS)
+      violation("medium never empties");
+    if (delivered[c] != accepted[c])
+      violation("accepted messages never delivered");
+  }
+}
+
+static void run(const uint8_t *data, size_t size)
+{
+  size_t i;
+
+  memset(medium, 0, sizeof medium);
+  memset(timeron, 0, sizeof timeron);
+  memset(accepted, 0, sizeof accepted);
+  memset(delivered, 0, sizeof delivered);
+  A_init();
+  B_init();
+  for (i=0; i<size; i++)
+    step(data[i]);
+  drain();
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  run(data, size);
+  return 0;
+}
+
+#ifndef LIBFUZZER
+
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+__AFL_FUZZ_INIT();
+#endif
+
+/* run random inputs and report executions per second */
+static void bench(long count)
+{
+  uint8_t input[64];
+  struct timeval start, end;
+  double elapsed;
+  long n;
+  size_t i;
+  unsigned int x = 1;
+
+  gettimeofday(&start, NULL);
+  for (n=0; n<count; n++) {
+    for (i=0; i<sizeof input; i++) {
+      x = x * 1103515245 + 12345;
+      input[i] = x >> 16;
+    }
+    run(input, sizeof input);
+  }
+  gettimeofday(&end, NULL);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  printf("%ld inputs of %lu steps in %.3f s (%.0f execs/s)\n",
+         count, (unsigned long)sizeof input, elapsed, elapsed > 0 ? count / elapsed : 0);
+}
+
+int main(int argc, char **argv)
+{
+  static uint8_t buf[1 << 16];
+  FILE *fp;
+  size_t len;
+  int i;
+
+#ifdef __AFL_FUZZ_TESTCASE_LEN
+  uint8_t *afl;
+
+  __AFL_INIT();
+  afl = __AFL_FUZZ_TESTCASE_BUF;
+  while (__AFL_LOOP(100000))
+    run(afl, __AFL_FUZZ_TESTCASE_LEN);
+  return EXIT_SUCCESS;
+#endif
+
+  if (argc == 3 && strcmp(argv[1], "--bench") == 0) {
+    bench(atol(argv[2]));
+    return EXIT_SUCCESS;
+  }
+  if (argc < 2) {                   /* one input on stdin */
+    len = fread(buf, 1, sizeof buf, stdin);
+    run(buf, len);
+    return EXIT_SUCCESS;
+  }
+  for (i=1; i<argc; i++) {
+    fp = fopen(argv[i], "rb");
+    if (fp == NULL) {
+      perror(argv[i]);
+      return EXIT_FAILURE;
+    }
+    len = fread(buf, 1, sizeof buf, fp);
+    fclose(fp);
+    run(buf, len);
+  }
+  return EXIT_SUCCESS;
+}
+
+#endif
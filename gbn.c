@@ -3,6 +3,9 @@
 #include <stdbool.h>
 #include "emulator.h"
 #include "gbn.h"
+#if FEC
+#include "fec.h"
+#endif
 
 /* ******************************************************************
    Go Back N protocol.  Adapted from J.F.Kurose
@@ -20,11 +23,19 @@
    - removed bidirectional GBN code and other code not used by prac. 
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - built with -DFEC, A's packets go out with XOR parity (fec.c).
+   - RTT, WINDOWSIZE and SEQSPACE can be given with -D, as tune.c does.
 **********************************************************************/
 
+#ifndef RTT
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
+#endif
+#ifndef WINDOWSIZE
 #define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+#endif
+#ifndef SEQSPACE
+#define SEQSPACE (WINDOWSIZE + 1)  /* the min sequence space for GBN must be at least windowsize + 1 */
+#endif
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
@@ -34,7 +45,7 @@
 */
 int ComputeChecksum(struct pkt packet)
 {
-  int checksum = 0;
+  unsigned int checksum = 0;    /* wraps around rather than overflowing */
   int i;
 
   checksum = packet.seqnum;
@@ -42,7 +53,7 @@ int ComputeChecksum(struct pkt packet)
   for ( i=0; i<20; i++ ) 
     checksum += (int)(packet.payload[i]);
 
-  return checksum;
+  return (int)checksum;
 }
 
 bool IsCorrupted(struct pkt packet)
@@ -56,53 +67,94 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+/* The state of every connection is kept in arrays indexed by connection
+   id (struct of arrays), so the state the timer and ACK paths look at for
+   many connections sits together in memory.  buffer holds WINDOWSIZE
+   packets per connection. */
+static struct pkt *buffer;      /* array for storing packets waiting for ACK */
+static int *windowfirst, *windowlast;  /* array indexes of the first/last packet awaiting ACK */
+static int *windowcount;        /* the number of packets currently awaiting an ACK */
+static int windowtotal;         /* windowcount summed over all connections */
+static int *A_nextseqnum;       /* the next sequence number to be used by the sender */
+
+/* allocate (or reallocate) an array of n elements of size bytes */
+static void *state_alloc(void *old, int n, size_t size)
+{
+  void *p;
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+  free(old);
+  p = calloc(n, size);
+  if (p == NULL) {
+    printf("memory allocation for connection state failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+/* send a data packet from A, with parity if FEC is on */
+static void A_send(struct pkt packet)
+{
+#if FEC
+  fec_output(packet);
+#else
+  tolayer3(A, packet);
+#endif
+}
+
+/* called from layer 5 (application layer), passed n messages to be sent to
+   the other side.  As many as fit are sent in one pass over the window
+   and the rest are refused; returns the number sent. */
+int A_output_batch(const struct msg *messages, int n)
 {
+  int c = connection;
+  struct pkt *buf = &buffer[c * WINDOWSIZE];  /* connection's window */
   struct pkt sendpkt;
-  int i;
+  int i, k;
 
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  /* while not blocked waiting on ACK */
+  for (k=0; k<n && windowcount[c] < WINDOWSIZE; k++) {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = A_nextseqnum[c];
     sendpkt.acknum = NOTINUSE;
     for ( i=0; i<20 ; i++ ) 
-      sendpkt.payload[i] = message.data[i];
+      sendpkt.payload[i] = messages[k].data[i];
     sendpkt.checksum = ComputeChecksum(sendpkt); 
 
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
+    windowlast[c] = (windowlast[c] + 1) % WINDOWSIZE; 
+    buf[windowlast[c]] = sendpkt;
+    windowcount[c]++;
+    windowtotal++;
 
     /* send out packet */
     if (TRACE > 0)
       printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+    A_send(sendpkt);
 
     /* start timer if first packet in window */
-    if (windowcount == 1)
+    if (windowcount[c] == 1)
       starttimer(A,RTT);
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+    A_nextseqnum[c] = (A_nextseqnum[c] + 1) % SEQSPACE;  
   }
-  /* if blocked,  window is full */
-  else {
+  /* the rest are blocked, window is full */
+  for (i=k; i<n; i++) {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
     window_full++;
   }
+  return k;
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+void A_output(struct msg message)
+{
+  A_output_batch(&message, 1);
 }
 
 
@@ -111,6 +163,8 @@ void A_output(struct msg message)
 */
 void A_input(struct pkt packet)
 {
+  int c = connection;
+  struct pkt *buf = &buffer[c * WINDOWSIZE];  /* connection's window */
   int ackcount = 0;
   int i;
 
@@ -119,11 +173,15 @@ void A_input(struct pkt packet)
     if (TRACE > 0)
       printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
     total_ACKs_received++;
-
-    /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
+#if FEC
+    fec_feedback(packet);
+#endif
+
+    /* check if new ACK or duplicate; an acknum outside the sequence
+       space can only come from a corrupted packet */
+    if (windowcount[c] != 0 && packet.acknum >= 0 && packet.acknum < SEQSPACE) {
+          int seqfirst = buf[windowfirst[c]].seqnum;
+          int seqlast = buf[windowlast[c]].seqnum;
           /* check case when seqnum has and hasn't wrapped */
           if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
               ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
@@ -140,15 +198,16 @@ void A_input(struct pkt packet)
               ackcount = SEQSPACE - seqfirst + packet.acknum;
 
 	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            windowfirst[c] = (windowfirst[c] + ackcount) % WINDOWSIZE;
 
             /* delete the acked packets from window buffer */
             for (i=0; i<ackcount; i++)
-              windowcount--;
+              windowcount[c]--;
+            windowtotal -= ackcount;
 
 	    /* start timer again if there are still more unacked packets in window */
             stoptimer(A);
-            if (windowcount > 0)
+            if (windowcount[c] > 0)
               starttimer(A, RTT);
 
           }
@@ -165,17 +224,19 @@ void A_input(struct pkt packet)
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
+  int c = connection;
+  struct pkt *buf = &buffer[c * WINDOWSIZE];  /* connection's window */
   int i;
 
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
-  for(i=0; i<windowcount; i++) {
+  for(i=0; i<windowcount[c]; i++) {
 
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+      printf ("---A: resending packet %d\n", (buf[(windowfirst[c]+i) % WINDOWSIZE]).seqnum);
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
+    A_send(buf[(windowfirst[c]+i) % WINDOWSIZE]);
     packets_resent++;
     if (i==0) starttimer(A,RTT);
   }
@@ -187,32 +248,85 @@ void A_timerinterrupt(void)
 /* entity A routines are called. You can use it to do any initialization */
 void A_init(void)
 {
+  int c;
+
+  buffer = state_alloc(buffer, nconnections * WINDOWSIZE, sizeof(struct pkt));
+  windowfirst = state_alloc(windowfirst, nconnections, sizeof(int));
+  windowlast = state_alloc(windowlast, nconnections, sizeof(int));
+  windowcount = state_alloc(windowcount, nconnections, sizeof(int));
+  A_nextseqnum = state_alloc(A_nextseqnum, nconnections, sizeof(int));
+
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+  for (c=0; c<nconnections; c++) {
+    A_nextseqnum[c] = 0;  /* A starts with seq num 0, do not change this */
+    windowfirst[c] = 0;
+    windowlast[c] = -1;   /* windowlast is where the last packet sent is stored.  
 		     new packets are placed in winlast + 1 
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+    windowcount[c] = 0;
+  }
+  windowtotal = 0;
+#if FEC
+  fec_init(A, SEQSPACE);
+#endif
+}
+
+
+/* save A's state to a snapshot file, return 0 on error */
+int A_save(FILE *fp)
+{
+  int n = nconnections;
+
+  return fwrite(buffer, sizeof(struct pkt), n * WINDOWSIZE, fp) == (size_t)(n * WINDOWSIZE)
+      && fwrite(windowfirst, sizeof(int), n, fp) == (size_t)n
+      && fwrite(windowlast, sizeof(int), n, fp) == (size_t)n
+      && fwrite(windowcount, sizeof(int), n, fp) == (size_t)n
+      && fwrite(A_nextseqnum, sizeof(int), n, fp) == (size_t)n
+#if FEC
+      && fec_save(A, fp)
+#endif
+      ;
+}
+
+/* restore A's state from a snapshot file, after A_init(), return 0 on error */
+int A_restore(FILE *fp)
+{
+  int n = nconnections, c, ok;
+
+  ok = fread(buffer, sizeof(struct pkt), n * WINDOWSIZE, fp) == (size_t)(n * WINDOWSIZE)
+      && fread(windowfirst, sizeof(int), n, fp) == (size_t)n
+      && fread(windowlast, sizeof(int), n, fp) == (size_t)n
+      && fread(windowcount, sizeof(int), n, fp) == (size_t)n
+      && fread(A_nextseqnum, sizeof(int), n, fp) == (size_t)n
+#if FEC
+      && fec_restore(A, fp)
+#endif
+      ;
+  /* the running total is not in the snapshot: count it again */
+  windowtotal = 0;
+  for (c=0; c<n; c++)
+    windowtotal += windowcount[c];
+  return ok;
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+static int *expectedseqnum; /* the sequence number expected next by the receiver */
+static int *B_nextseqnum;   /* the sequence number for the next packets sent by B */
 
 
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+/* a packet from A, after FEC if it is on */
+static void B_receive(struct pkt packet)
 {
+  int c = connection;
   struct pkt sendpkt;
   int i;
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
+  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum[c]) ) {
     if (TRACE > 0)
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
     packets_received++;
@@ -221,28 +335,31 @@ void B_input(struct pkt packet)
     tolayer5(B, packet.payload);
 
     /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    sendpkt.acknum = expectedseqnum[c];
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;        
+    expectedseqnum[c] = (expectedseqnum[c] + 1) % SEQSPACE;        
   }
   else {
     /* packet is corrupted or out of order resend last ACK */
     if (TRACE > 0) 
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
+    if (expectedseqnum[c] == 0)
       sendpkt.acknum = SEQSPACE - 1;
     else
-      sendpkt.acknum = expectedseqnum - 1;
+      sendpkt.acknum = expectedseqnum[c] - 1;
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+  sendpkt.seqnum = B_nextseqnum[c];
+  B_nextseqnum[c] = (B_nextseqnum[c] + 1) % 2;
     
   /* we don't have any data to send.  fill payload with 0's */
   for ( i=0; i<20 ; i++ ) 
     sendpkt.payload[i] = '0';  
+#if FEC
+  fec_stamp(&sendpkt);
+#endif
 
   /* computer checksum */
   sendpkt.checksum = ComputeChecksum(sendpkt); 
@@ -251,12 +368,81 @@ void B_input(struct pkt packet)
   tolayer3 (B, sendpkt);
 }
 
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+void B_input(struct pkt packet)
+{
+#if FEC
+  fec_input(packet, B_receive);
+#else
+  B_receive(packet);
+#endif
+}
+
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  int c;
+
+  expectedseqnum = state_alloc(expectedseqnum, nconnections, sizeof(int));
+  B_nextseqnum = state_alloc(B_nextseqnum, nconnections, sizeof(int));
+  for (c=0; c<nconnections; c++) {
+    expectedseqnum[c] = 0;
+    B_nextseqnum[c] = 1;
+  }
+#if FEC
+  fec_init(B, SEQSPACE);
+#endif
+}
+
+
+/* save B's state to a snapshot file, return 0 on error */
+int B_save(FILE *fp)
+{
+  int n = nconnections;
+
+  return fwrite(expectedseqnum, sizeof(int), n, fp) == (size_t)n
+      && fwrite(B_nextseqnum, sizeof(int), n, fp) == (size_t)n
+#if FEC
+      && fec_save(B, fp)
+#endif
+      ;
+}
+
+/* restore B's state from a snapshot file, after B_init(), return 0 on error */
+int B_restore(FILE *fp)
+{
+  int n = nconnections;
+
+  return fread(expectedseqnum, sizeof(int), n, fp) == (size_t)n
+      && fread(B_nextseqnum, sizeof(int), n, fp) == (size_t)n
+#if FEC
+      && fec_restore(B, fp)
+#endif
+      ;
+}
+
+/* number of messages the current connection can take now */
+int A_windowopen(void)
+{
+  return WINDOWSIZE - windowcount[connection];
+}
+
+/* packets awaiting an ACK, summed over all connections */
+int A_windowcount(void)
+{
+  return windowtotal;
+}
+
+/* bytes of A and B state kept for each connection */
+size_t connection_state_size(void)
+{
+  size_t size = WINDOWSIZE * sizeof(struct pkt) + 6 * sizeof(int);
+
+#if FEC
+  size += fec_state_size();
+#endif
+  return size;
 }
 
 /******************************************************************************
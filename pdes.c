@@ -0,0 +1,684 @@
+/* ******************************************************************
+   PARALLEL MULTI-HOP NETWORK EMULATOR
+
+   Runs the A and B entities of gbn.c or sr.c across a chain of
+   store-and-forward routers instead of a single channel:
+
+        A --- R1 --- R2 --- ... --- Rn --- B
+
+   Every node is a logical process (LP) with its own event list, clock
+   and random number stream, and owns the two channels leading out of
+   it, which lose, delay and corrupt packets with the same model as
+   tolayer3().  A packet handed to a channel arrives no sooner than 1
+   time unit later, and that minimum delay is the lookahead used to run
+   the LPs in parallel conservatively: each LP publishes on each of its
+   outgoing links a promise that no later packet will arrive before some
+   time (a null message), and only processes events earlier than the
+   promises of both of its neighbours.
+
+   The events of an LP are always processed in (time, origin LP, origin
+   sequence number) order, which depends only on the simulation and not
+   on how the threads are scheduled, so a parallel run gives exactly the
+   same results as the sequential one (--threads 0).
+
+   The threads share no counter on the hot path.  Each LP publishes, on
+   a cache line of its own, how much it has done and whether it is idle
+   (no events, nothing waiting to go out); the run is over when two
+   scans in a row find every LP idle, every link empty and no LP having
+   done anything in between.  A thread that finds nothing to do spins
+   (if every thread has a CPU), then yields, then sleeps for a while
+   before it looks again.
+
+   Build with: gcc -O2 -pthread pdes.c rng.c channel.c gbn.c -lm   (or sr.c)
+   ********************************************************************* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/time.h>
+#include "emulator.h"
+#include "gbn.h"
+#include "rng.h"
+#include "channel.h"
+
+/* possible events: */
+#define  TIMER_INTERRUPT 0
+#define  FROM_LAYER5     1
+#define  FROM_LAYER3     2
+
+/* directions a packet can travel in */
+#define  LEFT            0    /* towards A */
+#define  RIGHT           1    /* towards B */
+
+int TRACE = 0;
+
+/* statistics updated by GBN */
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+/* one connection between A and B */
+int nconnections = 1;
+int connection = 0;
+
+struct lpevent {
+  float evtime;           /* event time */
+  int evtype;             /* event type code */
+  int dir;                /* direction a FROM_LAYER3 packet travels in */
+  int origin;             /* LP that created the event */
+  unsigned long seq;      /* creation order at the origin LP */
+  struct pkt pkt;         /* packet (if any) assoc w/ this event */
+};
+
+/* single producer, single consumer queue of packets from one LP to its
+   neighbour, and the sender's promise about the packets still to come */
+#define RINGSIZE 4096
+struct link {
+  struct lpevent ring[RINGSIZE];
+  /* on lines of their own, as they are written by different threads */
+  _Alignas(64) atomic_ulong head; /* next slot to read, written by receiver */
+  _Alignas(64) atomic_ulong tail; /* next slot to write, written by sender */
+  _Alignas(64) _Atomic float promise;  /* no packet will arrive before this time */
+};
+
+/* what an LP has done, published for the termination scan: the number
+   of times its state changed, shifted left by one, with the low bit set
+   while it is idle */
+struct lpstatus {
+  _Alignas(64) atomic_ulong word;
+};
+
+struct lp {
+  int id;
+  float time;                     /* LP's clock */
+  struct lpevent *heap;           /* pending events, earliest first */
+  int nheap, heapsize;
+  unsigned long nextseq;
+  struct rng rng;
+  struct channel out[2];          /* medium towards the left/right neighbour */
+  float lastarrival[2];           /* latest arrival already scheduled on out[] */
+  struct link *inlink[2];         /* packets from the left/right neighbour */
+  struct link *outlink[2];        /* packets to the left/right neighbour */
+  float bound[2];                 /* promise last read from each inlink */
+  float promised[2];              /* promise last published on each outlink */
+  struct lpevent *overflow[2];    /* packets that did not fit in an outlink */
+  int noverflow[2], overflowsize[2];
+  int timeron;                    /* host timer running */
+  unsigned long timerseq;         /* seq of the running timer's event */
+  unsigned long activity;         /* state changes, for struct lpstatus */
+  unsigned long published;        /* last word written to its lpstatus */
+  long nevents;                   /* events processed */
+  float lastevtime;               /* time of the last event processed */
+  int nlost, ncorrupt, nsent;
+};
+
+static struct lp *lps;
+static int nlp;                   /* routers + 2 */
+static struct lp *hostlp[2];      /* LPs running A and B */
+static int nthreads;              /* 0 runs the LPs sequentially */
+static struct lpstatus *status;   /* per LP */
+static atomic_int finished;       /* a thread has found the run over */
+static int spins;                 /* idle rounds a thread spins before yielding */
+
+static int nsim = 0;              /* number of messages from 5 to 4 so far */
+static int nsimmax = 1000;        /* number of msgs to generate, then stop */
+static float lossprob = 0;        /* probability that a packet is dropped  */
+static float corruptprob = 0;     /* probability that a packet is corrupted */
+static float lambda = 10;         /* arrival rate of messages from layer 5 */
+static unsigned int seed = 9999;  /* LP i draws from a stream seeded seed+i */
+static int messages_delivered;
+
+/********************* EVENT LISTS *******/
+
+static int before(struct lpevent *a, struct lpevent *b)
+{
+  if (a->evtime != b->evtime)
+    return a->evtime < b->evtime;
+  if (a->origin != b->origin)
+    return a->origin < b->origin;
+  return a->seq < b->seq;
+}
+
+static void heap_push(struct lp *lp, struct lpevent *ev)
+{
+  struct lpevent tmp;
+  int i, parent;
+
+  if (lp->nheap == lp->heapsize) {
+    lp->heapsize = lp->heapsize ? 2*lp->heapsize : 64;
+    lp->heap = realloc(lp->heap, lp->heapsize * sizeof(struct lpevent));
+    if (lp->heap == NULL) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  i = lp->nheap++;
+  lp->heap[i] = *ev;
+  while (i > 0 && before(&lp->heap[i], &lp->heap[parent = (i-1)/2])) {
+    tmp = lp->heap[i];
+    lp->heap[i] = lp->heap[parent];
+    lp->heap[parent] = tmp;
+    i = parent;
+  }
+}
+
+static void heap_pop(struct lp *lp, struct lpevent *ev)
+{
+  struct lpevent tmp;
+  int i, child;
+
+  *ev = lp->heap[0];
+  lp->heap[0] = lp->heap[--lp->nheap];
+  i = 0;
+  while ((child = 2*i+1) < lp->nheap) {
+    if (child+1 < lp->nheap && before(&lp->heap[child+1], &lp->heap[child]))
+      child++;
+    if (!before(&lp->heap[child], &lp->heap[i]))
+      break;
+    tmp = lp->heap[i];
+    lp->heap[i] = lp->heap[child];
+    lp->heap[child] = tmp;
+    i = child;
+  }
+}
+
+/* schedule an event created by lp at lp */
+static void schedule(struct lp *lp, float evtime, int evtype)
+{
+  struct lpevent ev;
+
+  memset(&ev, 0, sizeof ev);
+  ev.evtime = evtime;
+  ev.evtype = evtype;
+  ev.origin = lp->id;
+  ev.seq = lp->nextseq++;
+  heap_push(lp, &ev);
+}
+
+/********************* LINKS *******/
+
+static int link_put(struct link *l, struct lpevent *ev)
+{
+  unsigned long t = atomic_load_explicit(&l->tail, memory_order_relaxed);
+
+  if (t - atomic_load_explicit(&l->head, memory_order_acquire) == RINGSIZE)
+    return 0;
+  l->ring[t % RINGSIZE] = *ev;
+  atomic_store_explicit(&l->tail, t+1, memory_order_release);
+  return 1;
+}
+
+/* move packets that did not fit into the ring earlier, return how many */
+static int flush_overflow(struct lp *lp, int dir)
+{
+  int i;
+
+  for (i=0; i<lp->noverflow[dir]; i++)
+    if (!link_put(lp->outlink[dir], &lp->overflow[dir][i]))
+      break;
+  memmove(lp->overflow[dir], lp->overflow[dir]+i,
+          (lp->noverflow[dir]-i) * sizeof(struct lpevent));
+  lp->noverflow[dir] -= i;
+  return i;
+}
+
+/* hand a packet to the neighbour in direction dir */
+static void link_send(struct lp *lp, int dir, struct lpevent *ev)
+{
+  struct lp *to = &lps[lp->id + (dir == RIGHT ? 1 : -1)];
+
+  if (nthreads == 0) {
+    heap_push(to, ev);
+    return;
+  }
+  if (lp->noverflow[dir] == 0 && link_put(lp->outlink[dir], ev))
+    return;
+  /* never wait for the receiver: it may be run by this thread */
+  if (lp->noverflow[dir] == lp->overflowsize[dir]) {
+    lp->overflowsize[dir] = lp->overflowsize[dir] ? 2*lp->overflowsize[dir] : 64;
+    lp->overflow[dir] = realloc(lp->overflow[dir], lp->overflowsize[dir] * sizeof(struct lpevent));
+    if (lp->overflow[dir] == NULL) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  lp->overflow[dir][lp->noverflow[dir]++] = *ev;
+}
+
+/* the store-and-forward hop: put a packet on the channel in direction dir */
+static void transmit(struct lp *lp, int dir, struct pkt *packet)
+{
+  struct lpevent ev;
+  float lastime;
+
+  lp->nsent++;
+  if (channel_lost(&lp->out[dir])) {
+    lp->nlost++;
+    if (TRACE>0)
+      printf("          LP %d: packet being lost\n", lp->id);
+    return;
+  }
+  memset(&ev, 0, sizeof ev);
+  ev.pkt = *packet;
+  ev.evtype = FROM_LAYER3;
+  ev.dir = dir;
+  ev.origin = lp->id;
+  ev.seq = lp->nextseq++;
+  lastime = lp->time;
+  if (lp->lastarrival[dir] > lastime)
+    lastime = lp->lastarrival[dir];
+  ev.evtime = channel_arrival(&lp->out[dir], lastime);
+  lp->lastarrival[dir] = ev.evtime;
+  if (channel_corrupt(&lp->out[dir], &ev.pkt)) {
+    lp->ncorrupt++;
+    if (TRACE>0)
+      printf("          LP %d: packet being corrupted\n", lp->id);
+  }
+  link_send(lp, dir, &ev);
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  transmit(hostlp[AorB], AorB == A ? RIGHT : LEFT, &packet);
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  messages_delivered++;
+}
+
+void tolayer5_batch(int AorB, const struct msg *msgs, int n)
+{
+  messages_delivered += n;
+}
+
+void starttimer(int AorB, double increment)
+{
+  struct lp *lp = hostlp[AorB];
+
+  if (lp->timeron) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  lp->timeron = 1;
+  lp->timerseq = lp->nextseq;
+  schedule(lp, lp->time + increment, TIMER_INTERRUPT);
+}
+
+/* the event stays on the list and is ignored when it comes up */
+void stoptimer(int AorB)
+{
+  struct lp *lp = hostlp[AorB];
+
+  if (!lp->timeron) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  lp->timeron = 0;
+}
+
+/********************** EVENT PROCESSING ***********************/
+
+static void generate_next_arrival(struct lp *lp)
+{
+  double x;
+
+  x = lambda * (rng_next(&lp->rng)/(double)RNG_MAX) * 2;  /* uniform on [0,2*lambda] */
+  schedule(lp, lp->time + x, FROM_LAYER5);
+}
+
+static void process(struct lp *lp, struct lpevent *ev)
+{
+  struct msg msg2give;
+  int i;
+
+  lp->time = ev->evtime;
+  if (ev->evtype == TIMER_INTERRUPT) {
+    if (!lp->timeron || ev->seq != lp->timerseq)
+      return;                     /* timer was stopped */
+    lp->timeron = 0;
+    if (lp == hostlp[A])
+      A_timerinterrupt();
+    else
+      B_timerinterrupt();
+  }
+  else if (ev->evtype == FROM_LAYER5) {
+    if (nsim < nsimmax) {
+      generate_next_arrival(lp);
+      for (i=0; i<20; i++)
+        msg2give.data[i] = 97 + nsim % 26;
+      nsim++;
+      A_output(msg2give);
+    }
+  }
+  else if (lp == hostlp[A] && ev->dir == LEFT)
+    A_input(ev->pkt);
+  else if (lp == hostlp[B] && ev->dir == RIGHT)
+    B_input(ev->pkt);
+  else
+    transmit(lp, ev->dir, &ev->pkt);   /* router: forward it */
+  lp->nevents++;
+  lp->lastevtime = lp->time;
+}
+
+/* publish lp's activity and whether it is idle */
+static void publish(struct lp *lp, int idle)
+{
+  unsigned long word = lp->activity << 1 | idle;
+
+  if (word != lp->published) {
+    lp->published = word;
+    atomic_store_explicit(&status[lp->id].word, word, memory_order_release);
+  }
+}
+
+/* process every event that is safe at lp and publish new promises,
+   return the number of events processed */
+static int lp_step(struct lp *lp)
+{
+  struct lpevent ev;
+  struct link *l;
+  unsigned long h, t;
+  float bound, p;
+  int dir, n = 0, moved = 0;
+
+  bound = 1e30;
+  for (dir=LEFT; dir<=RIGHT; dir++) {
+    if ((l = lp->inlink[dir]) == NULL)
+      continue;
+    /* read the promise first: every packet sent before it was made is
+       then already in the ring */
+    lp->bound[dir] = atomic_load_explicit(&l->promise, memory_order_acquire);
+    h = atomic_load_explicit(&l->head, memory_order_relaxed);
+    t = atomic_load_explicit(&l->tail, memory_order_acquire);
+    if (h != t) {
+      /* busy before the ring is seen empty, so that a scan never finds
+         both the packets gone and this LP idle */
+      lp->activity++;
+      publish(lp, 0);
+    }
+    for (; h != t; h++)
+      heap_push(lp, &l->ring[h % RINGSIZE]);
+    atomic_store_explicit(&l->head, h, memory_order_release);
+    if (lp->bound[dir] < bound)
+      bound = lp->bound[dir];
+  }
+
+  while (lp->nheap > 0 && lp->heap[0].evtime < bound) {
+    heap_pop(lp, &ev);
+    process(lp, &ev);
+    n++;
+  }
+
+  /* nothing sent from now on can leave before the earlier of the next
+     event and the neighbours' promises, nor overtake the last packet */
+  if (lp->nheap > 0 && lp->heap[0].evtime < bound)
+    bound = lp->heap[0].evtime;
+  for (dir=LEFT; dir<=RIGHT; dir++) {
+    if (lp->outlink[dir] == NULL)
+      continue;
+    moved += flush_overflow(lp, dir);
+    p = bound > lp->lastarrival[dir] ? bound : lp->lastarrival[dir];
+    p = p + 1;
+    if (lp->noverflow[dir] > 0 && lp->overflow[dir][0].evtime < p)
+      p = lp->overflow[dir][0].evtime;
+    if (p > lp->promised[dir]) {
+      lp->promised[dir] = p;
+      atomic_store_explicit(&lp->outlink[dir]->promise, p, memory_order_release);
+    }
+  }
+  if (n > 0 || moved > 0)
+    lp->activity++;
+  publish(lp, lp->nheap == 0 && lp->noverflow[LEFT] == 0 && lp->noverflow[RIGHT] == 0);
+  return n;
+}
+
+/* read every LP's status into word, 0 if some LP is busy or some link
+   still holds packets.  The links into an LP are read before its status:
+   an LP that empties a link says it is busy first. */
+static int scan(unsigned long *word)
+{
+  struct link *l;
+  int i, dir;
+
+  for (i=0; i<nlp; i++) {
+    for (dir=LEFT; dir<=RIGHT; dir++)
+      if ((l = lps[i].inlink[dir]) != NULL
+          && atomic_load_explicit(&l->head, memory_order_acquire)
+             != atomic_load_explicit(&l->tail, memory_order_acquire))
+        return 0;
+    word[i] = atomic_load_explicit(&status[i].word, memory_order_acquire);
+    if (!(word[i] & 1))
+      return 0;
+  }
+  return 1;
+}
+
+/* true if the run is over: two scans find everything idle and nothing
+   done in between */
+static int quiescent(unsigned long *first, unsigned long *second)
+{
+  return scan(first) && scan(second)
+      && memcmp(first, second, nlp * sizeof(unsigned long)) == 0;
+}
+
+#define SPINS  64                 /* idle rounds spent spinning, with a CPU each */
+#define YIELDS 1024               /* then yielding, before sleeping */
+
+static void *worker(void *arg)
+{
+  static const struct timespec nap = { 0, 20000 };
+  unsigned long *first, *second;
+  long self = (long)arg;
+  int i, n, idle = 0;
+
+  first = malloc(2 * nlp * sizeof(unsigned long));
+  if (first == NULL) {
+    printf("memory allocation for threads failed.");
+    exit(EXIT_FAILURE);
+  }
+  second = first + nlp;
+  while (!atomic_load_explicit(&finished, memory_order_relaxed)) {
+    n = 0;
+    for (i=self; i<nlp; i+=nthreads)
+      n += lp_step(&lps[i]);
+    if (n > 0) {
+      idle = 0;
+      continue;
+    }
+    if (++idle < spins)
+      continue;
+    if (quiescent(first, second)) {
+      atomic_store(&finished, 1);
+      break;
+    }
+    if (idle < YIELDS)
+      sched_yield();
+    else
+      nanosleep(&nap, NULL);
+  }
+  free(first);
+  return NULL;
+}
+
+/* run every LP from one global ordering of events */
+static void run_sequential(void)
+{
+  struct lpevent ev;
+  struct lp *next;
+  int i;
+
+  while (1) {
+    next = NULL;
+    for (i=0; i<nlp; i++)
+      if (lps[i].nheap > 0 && (next == NULL || before(&lps[i].heap[0], &next->heap[0])))
+        next = &lps[i];
+    if (next == NULL)
+      return;
+    heap_pop(next, &ev);
+    process(next, &ev);
+  }
+}
+
+static void run_parallel(void)
+{
+  pthread_t *threads;
+  long i;
+
+  threads = malloc(nthreads * sizeof(pthread_t));
+  status = aligned_alloc(64, nlp * sizeof(struct lpstatus));
+  if (threads == NULL || status == NULL) {
+    printf("memory allocation for threads failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<nlp; i++)
+    atomic_init(&status[i].word, 0);     /* busy until it has looked */
+  /* spinning only helps when the other threads are running meanwhile */
+  spins = nthreads <= sysconf(_SC_NPROCESSORS_ONLN) ? SPINS : 0;
+  for (i=0; i<nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, (void *)i) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  for (i=0; i<nthreads; i++)
+    pthread_join(threads[i], NULL);
+  free(threads);
+}
+
+static void setup(int nrouters)
+{
+  struct lp *lp;
+  struct link *l;
+  int i, dir;
+
+  nlp = nrouters + 2;
+  lps = calloc(nlp, sizeof(struct lp));
+  if (lps == NULL) {
+    printf("memory allocation for LPs failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i=0; i<nlp; i++) {
+    lp = &lps[i];
+    lp->id = i;
+    rng_seed(&lp->rng, seed + i);
+    for (dir=LEFT; dir<=RIGHT; dir++) {
+      lp->out[dir].lossprob = lossprob;
+      lp->out[dir].corruptprob = corruptprob;
+      lp->out[dir].rng = &lp->rng;
+    }
+  }
+  /* one link each way between neighbours */
+  for (i=0; i+1<nlp; i++)
+    for (dir=LEFT; dir<=RIGHT; dir++) {
+      l = calloc(1, sizeof(struct link));
+      if (l == NULL) {
+        printf("memory allocation for links failed.");
+        exit(EXIT_FAILURE);
+      }
+      if (dir == RIGHT) {
+        lps[i].outlink[RIGHT] = l;
+        lps[i+1].inlink[LEFT] = l;
+      }
+      else {
+        lps[i+1].outlink[LEFT] = l;
+        lps[i].inlink[RIGHT] = l;
+      }
+    }
+  hostlp[A] = &lps[0];
+  hostlp[B] = &lps[nlp-1];
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [options]\n", prog);
+  printf("  --routers <n>        routers between A and B (default 0)\n");
+  printf("  --threads <n>        worker threads, 0 runs sequentially (default 0)\n");
+  printf("  --msgs <n>           number of messages to simulate (default 1000)\n");
+  printf("  --loss <p>           loss probability of each hop\n");
+  printf("  --corrupt <p>        corruption probability of each hop\n");
+  printf("  --lambda <t>         average time between messages (default 10)\n");
+  printf("  --seed <n>           random number seed (default 9999)\n");
+  printf("  --trace <n>          TRACE level (default 0)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  static struct option options[] = {
+    {"routers", required_argument, NULL, 'R'},
+    {"threads", required_argument, NULL, 'j'},
+    {"msgs",    required_argument, NULL, 'n'},
+    {"loss",    required_argument, NULL, 'l'},
+    {"corrupt", required_argument, NULL, 'c'},
+    {"lambda",  required_argument, NULL, 'm'},
+    {"seed",    required_argument, NULL, 'S'},
+    {"trace",   required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0}
+  };
+  struct timeval start, end;
+  double elapsed;
+  long events = 0;
+  int nrouters = 0, nlost = 0, ncorrupt = 0, nsent = 0;
+  int i, c;
+  float endtime = 0;
+
+  while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (c) {
+    case 'R': nrouters = atoi(optarg); break;
+    case 'j': nthreads = atoi(optarg); break;
+    case 'n': nsimmax = atoi(optarg); break;
+    case 'l': lossprob = atof(optarg); break;
+    case 'c': corruptprob = atof(optarg); break;
+    case 'm': lambda = atof(optarg); break;
+    case 'S': seed = strtoul(optarg, NULL, 10); break;
+    case 't': TRACE = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc || nrouters < 0 || nthreads < 0 || lambda <= 0)
+    usage(argv[0]);
+
+  setup(nrouters);
+  if (nthreads > nlp)
+    nthreads = nlp;
+  A_init();
+  B_init();
+  generate_next_arrival(hostlp[A]);    /* initialize event list */
+
+  gettimeofday(&start, NULL);
+  if (nthreads == 0)
+    run_sequential();
+  else
+    run_parallel();
+  gettimeofday(&end, NULL);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+  for (i=0; i<nlp; i++) {
+    events += lps[i].nevents;
+    nlost += lps[i].nlost;
+    ncorrupt += lps[i].ncorrupt;
+    nsent += lps[i].nsent;
+    if (lps[i].lastevtime > endtime)
+      endtime = lps[i].lastevtime;
+  }
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n", endtime, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  printf("number of correct packets received at B:  %d \n", packets_received);
+  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  printf("number of hop transmissions: %d, lost: %d, corrupted: %d \n", nsent, nlost, ncorrupt);
+  printf("%d routers, %d LPs on %d threads: %ld events in %.3f s (%.0f events/s)\n",
+         nrouters, nlp, nthreads, events, elapsed, elapsed > 0 ? events / elapsed : 0);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,617 @@
+/* ******************************************************************
+   UDP IMPAIRMENT PROXY
+
+   Puts the emulator's medium between real UDP programs on the local
+   machine, like netem does in the kernel:
+
+        client ---> proxy (--listen) ---> server (--target)
+        client <--- proxy <------------- server
+
+   - datagrams are read with recvmmsg(), up to BATCH at a time, from the
+   listening socket and from one socket per flow connected to the
+   server, all waited on with epoll;
+   - every datagram is lost, delayed and corrupted by the channel model
+   of its direction (channel.c), with the emulator's Bernoulli or
+   Gilbert-Elliott loss.  All flows share the channel of a direction,
+   but each flow keeps its datagrams in order: one arrives 1 to
+   10 time units (scaled to --delay) after the later of its arrival at
+   the proxy and the previous datagram of its flow and direction, where
+   one time unit is --unit microseconds;
+   - a corrupted datagram has the field of a struct pkt the channel hit
+   changed in place, or its last byte inverted if it is shorter;
+   - delayed datagrams wait in a timing wheel of WHEELSIZE slots of
+   --tick microseconds, which a timerfd turns while it holds any, and
+   leave with sendmmsg(), those due together for the same socket in
+   one call.
+
+   A flow is the address and port of a client.  The first datagram from
+   a new client opens a socket to the server for it, and what the server
+   sends back on that socket goes to that client.  Once MAXFLOWS/2 flows
+   are open, datagrams from further clients are refused and counted.  At
+   the end of the run (--duration, SIGINT or SIGTERM) the proxy prints
+   the counters of each flow and direction, the datagrams refused and the
+   datagrams per second it forwarded.
+
+   Build with: gcc -O2 proxy.c rng.c channel.c -lm
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "emulator.h"
+#include "rng.h"
+#include "channel.h"
+
+#define BATCH 64                /* datagrams per sendmmsg()/recvmmsg() */
+#define MAXDGRAM 65536          /* largest datagram */
+#define MAXFLOWS 4096           /* clients, a power of two */
+#define WHEELSIZE 4096          /* slots of the timing wheel, a power of two */
+#define NOUT 8                  /* sockets with a sendmmsg() batch open */
+#define LISTENER MAXFLOWS       /* epoll data of the listening socket */
+#define TICKER (MAXFLOWS + 1)   /* and of the wheel's timerfd */
+#define FWD 0                   /* client to server */
+#define REV 1                   /* server to client */
+
+int TRACE = 0;
+
+/* one client and what happened to its datagrams in each direction */
+struct flow {
+  struct sockaddr_in client;
+  int fd;                       /* connected to the server, -1 if unused */
+  double last[2];               /* arrival of its latest datagram, time units */
+  long received[2];             /* datagrams read */
+  long lost[2], corrupted[2];   /* by the channel */
+  long overflowed[2];           /* dropped with the wheel full */
+  long unsent[2];               /* dropped when the socket would not take them */
+  long forwarded[2];            /* datagrams and bytes sent on */
+  long long bytes[2];
+};
+
+/* a datagram waiting in the wheel */
+struct held {
+  struct held *next;
+  long due;                     /* tick it leaves at */
+  int flow, dir, len;
+  char data[];
+};
+
+struct slot {
+  struct held *head, *tail;
+};
+
+static struct flow flows[MAXFLOWS];
+static int nflows;
+static struct slot wheel[WHEELSIZE];
+static long tick;               /* last tick turned */
+static long nheld;              /* datagrams in the wheel */
+static int ticking;             /* the wheel's timerfd is armed */
+
+static struct rng rng;
+static struct channel channels[2];  /* FWD and REV */
+
+static int epfd, listenfd, tickfd;
+static struct sockaddr_in target;
+static struct timespec start;   /* clock at time 0 */
+static long recvcalls, sendcalls;
+static long refused;            /* datagrams from clients findflow() found no room for */
+static volatile sig_atomic_t stopping;
+
+/* settings */
+static struct sockaddr_in listenaddr;
+static float lossprob = 0;      /* probability that a datagram is dropped */
+static float corruptprob = 0;   /* probability that a datagram is corrupted */
+static int direction = 2;       /* impaired directions: 0 FWD, 1 REV, 2 both */
+static int gilberton;           /* bursty loss instead of lossprob */
+static struct gilbert gilbert;
+static float delay = 0;         /* mean delay in time units, 0 for 5.5 */
+static int skipsampling;
+static long unit = 1000;        /* microseconds per time unit */
+static long tickns = 50000;     /* nanoseconds per wheel slot */
+static long limit = 100000;     /* datagrams the wheel holds at most */
+static double duration = 0;     /* seconds to run, 0 until a signal */
+static unsigned int seed = 9999;
+
+static void fail(const char *what)
+{
+  printf("%s failed: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+/* nanoseconds since start */
+static long elapsedns(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - start.tv_sec) * 1000000000L + (t.tv_nsec - start.tv_nsec);
+}
+
+static void watch(int fd, unsigned int data)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.u32 = data;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    fail("epoll_ctl");
+}
+
+static int udpsocket(void)
+{
+  int fd, size = 4 << 20;
+
+  fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    fail("socket");
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof size);
+  return fd;
+}
+
+/* the flow of a client, opened if it is new; -1 if the table is full */
+static int findflow(const struct sockaddr_in *client)
+{
+  unsigned int h;
+  int i, n;
+
+  h = (ntohl(client->sin_addr.s_addr) * 2654435761u) ^ ntohs(client->sin_port);
+  for (n=0; n<MAXFLOWS; n++) {
+    i = (h + n) & (MAXFLOWS - 1);
+    if (flows[i].fd < 0)
+      break;
+    if (flows[i].client.sin_addr.s_addr == client->sin_addr.s_addr
+        && flows[i].client.sin_port == client->sin_port)
+      return i;
+  }
+  if (n == MAXFLOWS || nflows == MAXFLOWS / 2)
+    return -1;                  /* keep the probes short */
+  flows[i].client = *client;
+  flows[i].fd = udpsocket();
+  if (connect(flows[i].fd, (struct sockaddr *)&target, sizeof target) < 0)
+    fail("connect");
+  watch(flows[i].fd, i);
+  nflows++;
+  if (TRACE>0)
+    printf("          PROXY: new flow from %s:%d\n",
+           inet_ntoa(client->sin_addr), ntohs(client->sin_port));
+  return i;
+}
+
+/********************** TIMING WHEEL ***********************/
+
+static void settick(int on)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof its);
+  if (on) {
+    its.it_value.tv_nsec = tickns % 1000000000L;
+    its.it_value.tv_sec = tickns / 1000000000L;
+    its.it_interval = its.it_value;
+  }
+  if (timerfd_settime(tickfd, 0, &its, NULL) < 0)
+    fail("timerfd_settime");
+  ticking = on;
+}
+
+/* datagrams leaving the wheel, one sendmmsg() for each socket they
+   leave on.  A flow's datagrams in a direction all leave on the same
+   socket, so keeping several batches open does not reorder them. */
+struct outbatch {
+  int fd, n;
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  struct held *held[BATCH];
+};
+static struct outbatch out[NOUT];
+
+static void flush(struct outbatch *o)
+{
+  int i, n, done = 0;
+
+  while (done < o->n) {
+    n = sendmmsg(o->fd, o->msgs + done, o->n - done, 0);
+    sendcalls++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != ECONNREFUSED && errno != EWOULDBLOCK)
+        fail("sendmmsg");
+      /* the socket is full or the server has gone: drop it */
+      flows[o->held[done]->flow].unsent[o->held[done]->dir]++;
+      done++;
+      continue;
+    }
+    for (i=done; i<done+n; i++) {
+      flows[o->held[i]->flow].forwarded[o->held[i]->dir]++;
+      flows[o->held[i]->flow].bytes[o->held[i]->dir] += o->held[i]->len;
+    }
+    done += n;
+  }
+  for (i=0; i<o->n; i++)
+    free(o->held[i]);
+  o->n = 0;
+}
+
+static void sendheld(struct held *h)
+{
+  struct flow *f = &flows[h->flow];
+  struct outbatch *o = NULL;
+  int fd = h->dir == FWD ? f->fd : listenfd, i;
+
+  /* the batch for fd, else an empty one, else the fullest is sent */
+  for (i=0; i<NOUT; i++)
+    if (out[i].n > 0 && out[i].fd == fd) {
+      o = &out[i];
+      break;
+    }
+  for (i=0; o == NULL && i<NOUT; i++)
+    if (out[i].n == 0)
+      o = &out[i];
+  if (o == NULL) {
+    o = &out[0];
+    for (i=1; i<NOUT; i++)
+      if (out[i].n > o->n)
+        o = &out[i];
+    flush(o);
+  }
+  o->fd = fd;
+  memset(&o->msgs[o->n], 0, sizeof o->msgs[o->n]);
+  o->iov[o->n].iov_base = h->data;
+  o->iov[o->n].iov_len = h->len;
+  o->msgs[o->n].msg_hdr.msg_iov = &o->iov[o->n];
+  o->msgs[o->n].msg_hdr.msg_iovlen = 1;
+  if (h->dir == REV) {
+    o->msgs[o->n].msg_hdr.msg_name = &f->client;
+    o->msgs[o->n].msg_hdr.msg_namelen = sizeof f->client;
+  }
+  o->held[o->n++] = h;
+  if (o->n == BATCH)
+    flush(o);
+}
+
+/* send what is due by now.  A flow's datagrams are due in the order they
+   came and every tick is turned in order, even after a stall of more
+   than a turn of the wheel, so they leave in that order. */
+static void turn(void)
+{
+  struct slot *s;
+  struct held *h, *keep, *keeptail, *next;
+  long now = elapsedns() / tickns, t;
+
+  for (t=tick+1; t<=now && nheld > 0; t++) {
+    s = &wheel[t & (WHEELSIZE-1)];
+    keep = keeptail = NULL;
+    for (h=s->head; h!=NULL; h=next) {
+      next = h->next;
+      if (h->due <= t) {
+        sendheld(h);
+        nheld--;
+      }
+      else {                    /* a later turn of the wheel */
+        h->next = NULL;
+        if (keeptail != NULL)
+          keeptail->next = h;
+        else
+          keep = h;
+        keeptail = h;
+      }
+    }
+    s->head = keep;
+    s->tail = keeptail;
+  }
+  tick = now;
+  for (t=0; t<NOUT; t++)
+    if (out[t].n > 0)
+      flush(&out[t]);
+  if (nheld == 0 && ticking)
+    settick(0);
+}
+
+/* a datagram arrives at the proxy from flow f going in direction dir */
+static void enter(int f, int dir, char *data, int len)
+{
+  struct flow *fl = &flows[f];
+  struct channel *ch = &channels[dir];
+  struct held *h;
+  struct slot *s;
+  struct pkt p;
+  double now, arrival;
+  int n;
+
+  fl->received[dir]++;
+  if (channel_lost(ch)) {
+    fl->lost[dir]++;
+    return;
+  }
+  if (nheld >= limit) {
+    fl->overflowed[dir]++;
+    return;
+  }
+  now = elapsedns() / 1000.0 / unit;
+  arrival = (fl->last[dir] > now ? fl->last[dir] : now) + channel_arrival(ch, 0);
+  fl->last[dir] = arrival;
+
+  /* corrupt the struct pkt the datagram starts with */
+  n = len < (int)sizeof p ? len : (int)sizeof p;
+  memset(&p, 0, sizeof p);
+  memcpy(&p, data, n);
+  if (channel_corrupt(ch, &p)) {
+    fl->corrupted[dir]++;
+    if (memcmp(&p, data, n) != 0)
+      memcpy(data, &p, n);
+    else if (len > 0)
+      data[len-1] = ~data[len-1];
+  }
+
+  h = malloc(sizeof(struct held) + len);
+  if (h == NULL) {
+    printf("memory allocation for datagram failed.");
+    exit(EXIT_FAILURE);
+  }
+  h->next = NULL;
+  h->due = (long)(arrival * unit * 1000 / tickns) + 1;
+  if (h->due <= tick)
+    h->due = tick + 1;
+  h->flow = f;
+  h->dir = dir;
+  h->len = len;
+  memcpy(h->data, data, len);
+  s = &wheel[h->due & (WHEELSIZE-1)];
+  if (s->tail != NULL)
+    s->tail->next = h;
+  else
+    s->head = h;
+  s->tail = h;
+  nheld++;
+  if (!ticking)
+    settick(1);
+}
+
+/********************** RECEIVING ***********************/
+
+static char inbuf[BATCH][MAXDGRAM];
+static struct mmsghdr inmsgs[BATCH];
+static struct iovec iniov[BATCH];
+static struct sockaddr_in inaddr[BATCH];
+
+/* read everything waiting on fd: from clients if f is -1, else from the
+   server for flow f */
+static void receive(int fd, int f)
+{
+  int i, n, flow;
+
+  do {
+    memset(inmsgs, 0, sizeof inmsgs);
+    for (i=0; i<BATCH; i++) {
+      iniov[i].iov_base = inbuf[i];
+      iniov[i].iov_len = MAXDGRAM;
+      inmsgs[i].msg_hdr.msg_iov = &iniov[i];
+      inmsgs[i].msg_hdr.msg_iovlen = 1;
+      inmsgs[i].msg_hdr.msg_name = &inaddr[i];
+      inmsgs[i].msg_hdr.msg_namelen = sizeof inaddr[i];
+    }
+    n = recvmmsg(fd, inmsgs, BATCH, MSG_DONTWAIT, NULL);
+    recvcalls++;
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+          || errno == ECONNREFUSED)
+        return;
+      fail("recvmmsg");
+    }
+    for (i=0; i<n; i++) {
+      if (f >= 0) {
+        enter(f, REV, inbuf[i], inmsgs[i].msg_len);
+        continue;
+      }
+      flow = findflow(&inaddr[i]);
+      if (flow >= 0)
+        enter(flow, FWD, inbuf[i], inmsgs[i].msg_len);
+      else
+        refused++;
+    }
+  } while (n == BATCH);
+}
+
+static void stop(int sig)
+{
+  stopping = 1;
+}
+
+static void run(void)
+{
+  struct epoll_event evs[BATCH];
+  uint64_t expirations;
+  int i, n, timeout;
+
+  epfd = epoll_create1(0);
+  tickfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (epfd < 0 || tickfd < 0)
+    fail("epoll/timerfd setup");
+  listenfd = udpsocket();
+  if (bind(listenfd, (struct sockaddr *)&listenaddr, sizeof listenaddr) < 0)
+    fail("bind");
+  watch(listenfd, LISTENER);
+  watch(tickfd, TICKER);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  timeout = duration > 0 ? 100 : -1;
+  while (!stopping && (duration <= 0 || elapsedns() < duration * 1e9)) {
+    n = epoll_wait(epfd, evs, BATCH, timeout);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("epoll_wait");
+    }
+    for (i=0; i<n; i++) {
+      if (evs[i].data.u32 == LISTENER)
+        receive(listenfd, -1);
+      else if (evs[i].data.u32 == TICKER) {
+        if (read(tickfd, &expirations, sizeof expirations) < 0)
+          continue;
+      }
+      else
+        receive(flows[evs[i].data.u32].fd, evs[i].data.u32);
+    }
+    if (nheld > 0)
+      turn();
+  }
+}
+
+/* host:port or port, on 127.0.0.1 if no host is given */
+static int parseaddr(const char *arg, struct sockaddr_in *addr)
+{
+  char host[64];
+  const char *colon = strrchr(arg, ':');
+  int port;
+
+  memset(addr, 0, sizeof *addr);
+  addr->sin_family = AF_INET;
+  strcpy(host, "127.0.0.1");
+  if (colon != NULL) {
+    if (colon - arg >= (long)sizeof host)
+      return 0;
+    memcpy(host, arg, colon - arg);
+    host[colon - arg] = 0;
+    arg = colon + 1;
+  }
+  port = atoi(arg);
+  if (port <= 0 || port > 65535 || inet_pton(AF_INET, host, &addr->sin_addr) != 1)
+    return 0;
+  addr->sin_port = htons(port);
+  return 1;
+}
+
+static void printdir(const char *name, struct flow *f, int dir)
+{
+  printf("  %s received %ld, lost %ld, corrupted %ld, overflowed %ld, unsent %ld, forwarded %ld (%lld bytes)\n",
+         name, f->received[dir], f->lost[dir], f->corrupted[dir], f->overflowed[dir],
+         f->unsent[dir], f->forwarded[dir], f->bytes[dir]);
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s --listen [<host>:]<port> --target [<host>:]<port> [options]\n", prog);
+  printf("  --loss <p>           probability that a datagram is dropped\n");
+  printf("  --corrupt <p>        probability that a datagram is corrupted\n");
+  printf("  --direction <d>      impaired directions: 0 client->server, 1 server->client,\n");
+  printf("                       2 both (default 2)\n");
+  printf("  --gilbert <p>,<r>,<lg>,<lb>\n");
+  printf("                       bursty loss: p good->bad, r bad->good, loss probability\n");
+  printf("                       lg when good and lb when bad\n");
+  printf("  --skip-sampling      draw the number of datagrams until the next loss or\n");
+  printf("                       corruption rather than deciding every datagram\n");
+  printf("  --delay <t>          mean delay in time units (default 5.5)\n");
+  printf("  --unit <us>          microseconds per time unit (default 1000)\n");
+  printf("  --tick <us>          microseconds per slot of the timing wheel (default 50)\n");
+  printf("  --limit <n>          datagrams held at most (default 100000)\n");
+  printf("  --duration <s>       seconds to run (default until SIGINT or SIGTERM)\n");
+  printf("  --seed <n>           random number seed (default 9999)\n");
+  printf("  --trace <n>          TRACE level (default 0)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  static struct option options[] = {
+    {"listen",    required_argument, NULL, 'L'},
+    {"target",    required_argument, NULL, 'T'},
+    {"loss",      required_argument, NULL, 'l'},
+    {"corrupt",   required_argument, NULL, 'c'},
+    {"direction", required_argument, NULL, 'd'},
+    {"gilbert",   required_argument, NULL, 'g'},
+    {"skip-sampling", no_argument,   NULL, 'k'},
+    {"delay",     required_argument, NULL, 'D'},
+    {"unit",      required_argument, NULL, 'u'},
+    {"tick",      required_argument, NULL, 'i'},
+    {"limit",     required_argument, NULL, 'm'},
+    {"duration",  required_argument, NULL, 'r'},
+    {"seed",      required_argument, NULL, 'S'},
+    {"trace",     required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0}
+  };
+  long forwarded = 0;
+  struct rusage ru;
+  double elapsed;
+  int c, i, dir, haslisten = 0, hastarget = 0;
+
+  while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (c) {
+    case 'L': haslisten = parseaddr(optarg, &listenaddr); if (!haslisten) usage(argv[0]); break;
+    case 'T': hastarget = parseaddr(optarg, &target); if (!hastarget) usage(argv[0]); break;
+    case 'l': lossprob = atof(optarg); break;
+    case 'c': corruptprob = atof(optarg); break;
+    case 'd': direction = atoi(optarg); break;
+    case 'g':
+      if (sscanf(optarg, "%f,%f,%f,%f", &gilbert.p, &gilbert.r,
+                 &gilbert.lossgood, &gilbert.lossbad) != 4)
+        usage(argv[0]);
+      gilberton = 1;
+      break;
+    case 'k': skipsampling = 1; break;
+    case 'D': delay = atof(optarg); break;
+    case 'u': unit = atol(optarg); break;
+    case 'i': tickns = (long)(atof(optarg) * 1000); break;
+    case 'm': limit = atol(optarg); break;
+    case 'r': duration = atof(optarg); break;
+    case 'S': seed = strtoul(optarg, NULL, 10); break;
+    case 't': TRACE = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc || !haslisten || !hastarget || unit <= 0 || tickns <= 0
+      || limit < 0 || delay < 0 || direction < 0 || direction > 2)
+    usage(argv[0]);
+
+  rng_seed(&rng, seed);
+  for (dir=FWD; dir<=REV; dir++) {
+    channels[dir].rng = &rng;
+    if (direction == 2 || direction == dir) {
+      channels[dir].lossprob = lossprob;
+      channels[dir].corruptprob = corruptprob;
+      if (gilberton) {
+        channels[dir].model = CHANNEL_GILBERT;
+        channels[dir].ge = gilbert;
+      }
+    }
+    channels[dir].delay = delay;
+    channels[dir].skip = skipsampling;
+  }
+  for (i=0; i<MAXFLOWS; i++)
+    flows[i].fd = -1;
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  signal(SIGPIPE, SIG_IGN);
+
+  run();
+
+  elapsed = elapsedns() / 1e9;
+  getrusage(RUSAGE_SELF, &ru);
+  printf(" Proxy stopped after %.3f s with %ld datagrams still held\n", elapsed, nheld);
+  for (i=0; i<MAXFLOWS; i++)
+    if (flows[i].fd >= 0) {
+      printf("flow %s:%d\n", inet_ntoa(flows[i].client.sin_addr), ntohs(flows[i].client.sin_port));
+      printdir("client->server:", &flows[i], FWD);
+      printdir("server->client:", &flows[i], REV);
+      forwarded += flows[i].forwarded[FWD] + flows[i].forwarded[REV];
+    }
+  printf("datagrams refused with the flow table full:  %ld \n", refused);
+  printf("%d flows, %ld recvmmsg, %ld sendmmsg, cpu %.3f s user %.3f s system\n",
+         nflows, recvcalls, sendcalls,
+         ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6,
+         ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6);
+  printf("datagrams forwarded per second:  %.0f \n", elapsed > 0 ? forwarded / elapsed : 0);
+  return EXIT_SUCCESS;
+}
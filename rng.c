@@ -0,0 +1,50 @@
+#include "rng.h"
+
+/****************************************************************************/
+/* Random number streams used by the emulator.  The generator is the        */
+/* trinomial x**31 + x**3 + 1 additive feedback generator behind glibc's    */
+/* rand(), so simulations seeded with srand(9999) keep giving the same      */
+/* results, but the state lives in a struct rng instead of inside libc.     */
+/****************************************************************************/
+
+#define DEGREE 31
+#define SEP 3
+
+void rng_seed(struct rng *g, unsigned int seed)
+{
+  long word, hi, lo;
+  int i;
+
+  if (seed == 0)
+    seed = 1;
+  g->state[0] = (int)seed;
+  word = (int)seed;
+  for (i=1; i<DEGREE; i++) {
+    /* state[i] = (16807 * state[i-1]) % 2147483647 without overflow */
+    hi = word / 127773;
+    lo = word % 127773;
+    word = 16807 * lo - 2836 * hi;
+    if (word < 0)
+      word += 2147483647;
+    g->state[i] = (int)word;
+  }
+  g->front = SEP;
+  g->rear = 0;
+  for (i=0; i<10*DEGREE; i++)   /* discard the start-up transient */
+    rng_next(g);
+}
+
+int rng_next(struct rng *g)
+{
+  unsigned int val;
+
+  val = (unsigned int)g->state[g->front] + (unsigned int)g->state[g->rear];
+  g->state[g->front] = (int)val;
+  if (++g->front >= DEGREE) {
+    g->front = 0;
+    ++g->rear;
+  }
+  else if (++g->rear >= DEGREE)
+    g->rear = 0;
+  return (int)(val >> 1);
+}
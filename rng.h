@@ -0,0 +1,21 @@
+#ifndef RNG_H
+#define RNG_H
+
+/* largest value returned by rng_next() */
+#define RNG_MAX 2147483647
+
+/* State of one random number stream.  This is the additive feedback
+   generator used by the GNU C library's rand(), kept in a plain struct
+   so that it can be copied, saved to a file and restored, and so that
+   several independent streams can be run side by side.  Seeded with the
+   same value it returns exactly the same sequence as srand()/rand(). */
+struct rng {
+  int state[31];
+  int front;              /* index of the leading tap */
+  int rear;               /* index of the trailing tap */
+};
+
+extern void rng_seed(struct rng *, unsigned int seed);
+extern int rng_next(struct rng *);       /* uniform int in [0,RNG_MAX] */
+
+#endif
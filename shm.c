@@ -0,0 +1,502 @@
+/* ******************************************************************
+   SHARED MEMORY TRANSPORT
+
+   Runs A, B and the medium between them as three processes that pass
+   struct pkt through lock-free single producer, single consumer rings
+   in a shared memory segment, without a system call on the packet path:
+
+        A ==ring==> channel ==ring==> B
+        A <==ring== channel <==ring== B
+
+   - the channel process loses, delays and corrupts packets with the
+   emulator's model (channel.c): a packet arrives 1 to 10 time units
+   after the later of its send time and the previous arrival in its
+   direction;
+   - starttimer()/stoptimer() set a deadline on the monotonic clock,
+   which every process reads through the vDSO, so the clock is shared
+   and reading it does not enter the kernel;
+   - messages arrive from layer 5 at A on average every --lambda time
+   units, as in the emulator, where one time unit is --unit nanoseconds.
+
+   Every process spins on its rings and never blocks.  A producer whose
+   ring is full keeps the packets in a private overflow queue and tries
+   again on its next pass, so no process ever waits for another.  With
+   fewer than three CPUs the spinning processes would take the CPU from
+   each other for whole scheduler slices, so there (or with --yield) a
+   pass that found nothing to do ends with sched_yield().
+
+   When A has sent all its messages and its timer has stopped the run
+   ends, and the report gives the packets per second and what each
+   process did.
+
+   Build with: gcc -O2 shm.c rng.c channel.c gbn.c -lm   (or sr.c)
+   ********************************************************************* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "emulator.h"
+#include "gbn.h"
+#include "rng.h"
+#include "channel.h"
+
+#define RINGSIZE 1024           /* packets per ring, a power of two */
+#define CHAN 2                  /* index of the channel process */
+
+int TRACE = 0;
+
+/* statistics updated by GBN */
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+/* one connection between A and B */
+int nconnections = 1;
+int connection = 0;
+
+/* single producer, single consumer ring of packets.  head and tail only
+   grow; each is written by one side and sits on its own cache line. */
+struct ring {
+  _Alignas(64) atomic_ulong head;       /* next slot to read, written by consumer */
+  _Alignas(64) atomic_ulong tail;       /* next slot to write, written by producer */
+  _Alignas(64) struct pkt slot[RINGSIZE];
+};
+
+/* what each process did */
+struct shmstats {
+  long sent, received;          /* packets put on and taken off rings */
+  long overflowed;              /* packets that found their ring full */
+  long polls;                   /* passes of the main loop */
+  long lost, corrupted;         /* channel only */
+  long timeouts;
+  double utime, stime;          /* CPU seconds in user and system mode */
+  int packets_received;         /* B's protocol statistics */
+  int messages_delivered;
+};
+
+struct shared {
+  struct ring up[2];            /* from A/B to the channel */
+  struct ring down[2];          /* from the channel to A/B */
+  atomic_int done;              /* set by A when the transfer is over */
+  struct shmstats stats[3];     /* [A], [B] and [CHAN] */
+};
+static struct shared *shm;
+
+static int self;                /* A, B or CHAN */
+static struct shmstats *st;     /* &shm->stats[self] */
+static struct timespec start;   /* time 0 of the run */
+static int timeron;
+static long timerdeadline;      /* ns since start */
+static long nextmsg;            /* ns since start of the next message */
+
+static int nsim = 0;            /* number of messages from 5 to 4 so far */
+static int nsimmax = 1000;      /* number of msgs to generate, then stop */
+static float lossprob = 0;      /* probability that a packet is dropped  */
+static float corruptprob = 0;   /* probability that a packet is corrupted */
+static float lambda = 10;       /* average time between messages */
+static int direction = 2;       /* impaired directions: 0 A->B, 1 A<-B, 2 both */
+static long unit = 1000;        /* nanoseconds per time unit */
+static unsigned int seed = 9999;
+static int yield = 0;           /* give up the CPU when idle */
+static struct rng rng;
+
+/* nanoseconds since the start of the run */
+static long now(void)
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - start.tv_sec) * 1000000000L + (t.tv_nsec - start.tv_nsec);
+}
+
+/********************** RINGS ***********************/
+
+/* packets waiting for room in a ring, kept in order */
+struct pktqueue {
+  struct pkt *pkt;
+  double *when;                 /* channel only: arrival time in time units */
+  int head, n, size;
+};
+
+static void qpush(struct pktqueue *q, struct pkt *p, double when)
+{
+  struct pkt *np;
+  double *nw;
+  int i;
+
+  if (q->n == q->size) {
+    np = malloc(2 * (q->size + 16) * sizeof(struct pkt));
+    nw = malloc(2 * (q->size + 16) * sizeof(double));
+    if (np == NULL || nw == NULL) {
+      printf("memory allocation for packet queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (i=0; i<q->n; i++) {
+      np[i] = q->pkt[(q->head + i) % q->size];
+      nw[i] = q->when[(q->head + i) % q->size];
+    }
+    free(q->pkt);
+    free(q->when);
+    q->pkt = np;
+    q->when = nw;
+    q->head = 0;
+    q->size = 2 * (q->size + 16);
+  }
+  q->pkt[(q->head + q->n) % q->size] = *p;
+  q->when[(q->head + q->n) % q->size] = when;
+  q->n++;
+}
+
+static void qpop(struct pktqueue *q)
+{
+  q->head = (q->head + 1) % q->size;
+  q->n--;
+}
+
+/* move packets from q to r while there is room and, for the channel,
+   they have arrived by time t; return how many */
+static int qflush(struct pktqueue *q, struct ring *r, double t)
+{
+  unsigned long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  unsigned long head = atomic_load_explicit(&r->head, memory_order_acquire);
+  unsigned long first = tail;
+
+  while (q->n > 0 && tail - head < RINGSIZE && q->when[q->head] <= t) {
+    r->slot[tail % RINGSIZE] = q->pkt[q->head];
+    tail++;
+    qpop(q);
+  }
+  if (tail != first) {
+    atomic_store_explicit(&r->tail, tail, memory_order_release);
+    st->sent += tail - first;
+  }
+  return tail - first;
+}
+
+/* put p on ring r, or on q behind the packets already waiting there */
+static void put(struct ring *r, struct pktqueue *q, struct pkt *p)
+{
+  unsigned long tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+  if (q->n == 0 && tail - atomic_load_explicit(&r->head, memory_order_acquire) < RINGSIZE) {
+    r->slot[tail % RINGSIZE] = *p;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    st->sent++;
+    return;
+  }
+  st->overflowed++;
+  qpush(q, p, 0);
+}
+
+/* hand every packet waiting on ring r to deliver(), return how many */
+static int take(struct ring *r, void (*deliver)(struct pkt *))
+{
+  unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned long tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  unsigned long i;
+  struct pkt p;
+
+  for (i=head; i<tail; i++) {
+    p = r->slot[i % RINGSIZE];
+    atomic_store_explicit(&r->head, i + 1, memory_order_release);
+    deliver(&p);
+  }
+  st->received += tail - head;
+  return tail - head;
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+static struct pktqueue overflow;  /* packets from A or B waiting for room */
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  put(&shm->up[self], &overflow, &packet);
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  st->messages_delivered++;
+}
+
+void tolayer5_batch(int AorB, const struct msg *msgs, int n)
+{
+  st->messages_delivered += n;
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (timeron) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  timeron = 1;
+  timerdeadline = now() + (long)(increment * unit);
+}
+
+void stoptimer(int AorB)
+{
+  if (!timeron) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  timeron = 0;
+}
+
+/********************** A AND B ***********************/
+
+static void advance_next_message(void)
+{
+  double x;
+
+  x = lambda * (rng_next(&rng)/(double)RNG_MAX) * 2;  /* uniform on [0,2*lambda] */
+  nextmsg += (long)(x * unit);
+}
+
+static void to_entity(struct pkt *p)
+{
+  if (self == A)
+    A_input(*p);
+  else
+    B_input(*p);
+}
+
+static void entity(void)
+{
+  struct msg msg2give;
+  long t;
+  int i, busy;
+
+  if (self == A) {
+    A_init();
+    advance_next_message();
+  }
+  else
+    B_init();
+
+  while (1) {
+    st->polls++;
+    t = now();
+    busy = 0;
+    while (self == A && nsim < nsimmax && nextmsg <= t) {
+      busy = 1;
+      for (i=0; i<20; i++)
+        msg2give.data[i] = 97 + nsim % 26;
+      nsim++;
+      A_output(msg2give);
+      advance_next_message();
+    }
+    busy |= take(&shm->down[self], to_entity);
+    if (timeron && t >= timerdeadline) {
+      busy = 1;
+      timeron = 0;
+      st->timeouts++;
+      if (self == A)
+        A_timerinterrupt();
+      else
+        B_timerinterrupt();
+    }
+    if (overflow.n > 0)
+      qflush(&overflow, &shm->up[self], 0);
+    if (self == A && nsim == nsimmax && !timeron && overflow.n == 0) {
+      /* everything sent has been acknowledged */
+      atomic_store(&shm->done, 1);
+      break;
+    }
+    if (self == B && atomic_load_explicit(&shm->done, memory_order_relaxed))
+      break;
+    if (yield && !busy)
+      sched_yield();
+  }
+  if (self == B)
+    st->packets_received = packets_received;
+}
+
+/********************** CHANNEL ***********************/
+
+static struct channel channels[2];  /* medium for packets sent by A and by B */
+static struct pktqueue delayed[2];  /* packets in the medium from A and B */
+static double lastarrival[2];
+static double nowunits;             /* current time in time units */
+static int sender;                  /* direction being taken */
+
+/* a packet from sender enters the medium */
+static void enter(struct pkt *p)
+{
+  double arrival;
+
+  if (channel_lost(&channels[sender])) {
+    st->lost++;
+    if (TRACE>0)
+      printf("          CHANNEL: packet being lost\n");
+    return;
+  }
+  /* medium can not reorder: arrive 1 to 10 units after the later of
+     now and the latest arrival already on its way */
+  arrival = nowunits > lastarrival[sender] ? nowunits : lastarrival[sender];
+  arrival += channel_arrival(&channels[sender], 0);
+  lastarrival[sender] = arrival;
+  if (channel_corrupt(&channels[sender], p)) {
+    st->corrupted++;
+    if (TRACE>0)
+      printf("          CHANNEL: packet being corrupted\n");
+  }
+  qpush(&delayed[sender], p, arrival);
+}
+
+static void channel(void)
+{
+  int s, busy;
+
+  for (s=A; s<=B; s++) {
+    channels[s].rng = &rng;
+    if (direction == 2 || direction == s) {
+      channels[s].lossprob = lossprob;
+      channels[s].corruptprob = corruptprob;
+    }
+  }
+  while (!atomic_load_explicit(&shm->done, memory_order_relaxed)) {
+    st->polls++;
+    nowunits = now() / (double)unit;
+    busy = 0;
+    for (s=A; s<=B; s++) {
+      sender = s;
+      busy |= take(&shm->up[s], enter);
+      if (delayed[s].n > 0)
+        busy |= qflush(&delayed[s], &shm->down[1-s], nowunits);
+    }
+    if (yield && !busy)
+      sched_yield();
+  }
+}
+
+/********************** REPORT ***********************/
+
+static void printproc(const char *name, struct shmstats *s)
+{
+  printf("%s: %ld packets put on rings (%ld found the ring full), %ld taken off\n",
+         name, s->sent, s->overflowed, s->received);
+  printf("%s: %ld polls, %ld timeouts, cpu %.3f s user %.3f s system\n",
+         name, s->polls, s->timeouts, s->utime, s->stime);
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [options]\n", prog);
+  printf("  --msgs <n>           number of messages to send (default 1000)\n");
+  printf("  --loss <p>           packet loss probability\n");
+  printf("  --corrupt <p>        packet corruption probability\n");
+  printf("  --direction <d>      impaired directions: 0 A->B, 1 A<-B, 2 both (default 2)\n");
+  printf("  --lambda <t>         average time between messages (default 10)\n");
+  printf("  --unit <ns>          nanoseconds per time unit (default 1000)\n");
+  printf("  --seed <n>           random number seed (default 9999)\n");
+  printf("  --yield              sched_yield() when idle (default with fewer than 3 CPUs)\n");
+  printf("  --trace <n>          TRACE level (default 0)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  static struct option options[] = {
+    {"msgs",      required_argument, NULL, 'n'},
+    {"loss",      required_argument, NULL, 'l'},
+    {"corrupt",   required_argument, NULL, 'c'},
+    {"direction", required_argument, NULL, 'd'},
+    {"lambda",    required_argument, NULL, 'm'},
+    {"unit",      required_argument, NULL, 'u'},
+    {"seed",      required_argument, NULL, 'S'},
+    {"trace",     required_argument, NULL, 't'},
+    {"yield",     no_argument,       NULL, 'y'},
+    {NULL, 0, NULL, 0}
+  };
+  struct rusage ru;
+  double elapsed;
+  pid_t pid[2];
+  int c, i;
+
+  while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (c) {
+    case 'n': nsimmax = atoi(optarg); break;
+    case 'l': lossprob = atof(optarg); break;
+    case 'c': corruptprob = atof(optarg); break;
+    case 'd': direction = atoi(optarg); break;
+    case 'm': lambda = atof(optarg); break;
+    case 'u': unit = atol(optarg); break;
+    case 'S': seed = strtoul(optarg, NULL, 10); break;
+    case 't': TRACE = atoi(optarg); break;
+    case 'y': yield = 1; break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc || nsimmax < 0 || lambda <= 0 || unit <= 0
+      || direction < 0 || direction > 2)
+    usage(argv[0]);
+  if (sysconf(_SC_NPROCESSORS_ONLN) < 3)
+    yield = 1;
+
+  shm = mmap(NULL, sizeof(struct shared), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shm == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  memset(shm, 0, sizeof(struct shared));
+  fflush(stdout);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  self = A;
+  for (i=0; i<2; i++) {
+    pid[i] = fork();
+    if (pid[i] < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+    if (pid[i] == 0) {
+      self = i == 0 ? CHAN : B;
+      break;
+    }
+  }
+  st = &shm->stats[self];
+  rng_seed(&rng, seed + self);
+  if (self == CHAN)
+    channel();
+  else
+    entity();
+  elapsed = now() / 1e9;
+  getrusage(RUSAGE_SELF, &ru);
+  st->utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+  st->stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  if (self != A)
+    exit(EXIT_SUCCESS);
+  for (i=0; i<2; i++)
+    waitpid(pid[i], NULL, 0);
+
+  printf(" Transfer finished after %.3f s\n after attempting to send %d msgs from layer5\n", elapsed, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  printf("number of correct packets received at B:  %d \n", shm->stats[B].packets_received);
+  printf("number of messages delivered to application:  %d \n", shm->stats[B].messages_delivered);
+  printf("channel: %ld packets in, %ld lost, %ld corrupted, %ld delivered\n",
+         shm->stats[CHAN].received, shm->stats[CHAN].lost, shm->stats[CHAN].corrupted,
+         shm->stats[CHAN].sent);
+  printproc("A", &shm->stats[A]);
+  printproc("B", &shm->stats[B]);
+  printproc("channel", &shm->stats[CHAN]);
+  printf("packets per second:  %.0f%s\n",
+         elapsed > 0 ? shm->stats[CHAN].received / elapsed : 0,
+         yield ? " (yielding when idle)" : "");
+  return EXIT_SUCCESS;
+}
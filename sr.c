@@ -3,6 +3,9 @@
 #include <stdbool.h>
 #include "emulator.h"
 #include "sr.h"
+#if FEC
+#include "fec.h"
+#endif
 
 
 /* ******************************************************************
@@ -21,12 +24,32 @@
    - removed bidirectional GBN code and other code not used by prac. 
    - fixed C style to adhere to current programming style
    - added GBN implementation
+   - built with -DNAK=1, B names the packets missing below each packet it
+   buffers in the ACK it sends, and A resends them at once rather than
+   waiting for its timer.  See B_input().
+   - built with -DFEC, A's packets go out with XOR parity (fec.c).
+   - RTT, WINDOWSIZE and SEQSPACE can be given with -D, as tune.c does.
 **********************************************************************/
 
+#ifndef RTT
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unalready_acked packet */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+#endif
+#ifndef WINDOWSIZE
+#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet */
+#endif
+#ifndef SEQSPACE
+#define SEQSPACE (2 * WINDOWSIZE)  /* the min sequence space for SR must be at least 2 * windowsize */
+#endif
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
+#ifndef NAK
+#define NAK 0           /* 1 = B asks for missing packets in its ACKs */
+#endif
+#define NAKHOLDOFF WINDOWSIZE  /* packets B receives before asking for the same one again */
+#define NAKBITS 6       /* missing packets named by each payload character */
+#define NAKCHARS 19     /* characters used; payload[19] carries the FEC loss report */
+#if NAK && WINDOWSIZE - 1 > NAKBITS * NAKCHARS
+#error "an ACK cannot name every missing packet of a window this large, build without NAK"
+#endif
 
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver  
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your 
@@ -35,14 +58,14 @@
 */
 int ComputeChecksum(struct pkt packet)
 {
-  int checksum = 0;
+  unsigned int checksum = 0;    /* wraps around rather than overflowing */
   int i;
   checksum = packet.seqnum;
   checksum += packet.acknum;
   for ( i=0; i<20; i++ ) 
     checksum += (int)(packet.payload[i]);
 
-  return checksum;
+  return (int)checksum;
 }
 
 bool IsCorrupted(struct pkt packet)
@@ -53,57 +76,108 @@ bool IsCorrupted(struct pkt packet)
     return (true);
 }
 
+/* true if seq is one of the count sequence numbers starting at first;
+   a number outside the sequence space (from a corrupted packet whose
+   checksum happened to match) never is */
+bool InWindow(int seq, int first, int count)
+{
+  if (seq < 0 || seq >= SEQSPACE)
+    return false;
+  return (seq - first + SEQSPACE) % SEQSPACE < count;
+}
+
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[SEQSPACE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-static bool already_acked[SEQSPACE];
+/* The state of every connection is kept in arrays indexed by connection
+   id (struct of arrays), so the state the timer and ACK paths look at for
+   many connections sits together in memory.  buffer holds WINDOWSIZE
+   packets and acked SEQSPACE flags per connection. */
+static struct pkt *buffer;      /* array for storing packets waiting for ACK */
+static int *windowfirst, *windowlast;  /* array indexes of the first/last packet awaiting ACK */
+static int *windowcount;        /* the number of packets currently awaiting an ACK */
+static int windowtotal;         /* windowcount summed over all connections */
+static int *A_nextseqnum;       /* the next sequence number to be used by the sender */
+static bool *acked;             /* ACKs received for packets still in the window */
+
+/* allocate (or reallocate) an array of n elements of size bytes */
+static void *state_alloc(void *old, int n, size_t size)
+{
+  void *p;
 
+  free(old);
+  p = calloc(n, size);
+  if (p == NULL) {
+    printf("memory allocation for connection state failed.");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
 
-/* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+
+/* send a data packet from A, with parity if FEC is on */
+static void A_send(struct pkt packet)
 {
-  int i;
+#if FEC
+  fec_output(packet);
+#else
+  tolayer3(A, packet);
+#endif
+}
+
+/* called from layer 5 (application layer), passed n messages to be sent to
+   the other side.  As many as fit are sent in one pass over the window
+   and the rest are refused; returns the number sent. */
+int A_output_batch(const struct msg *messages, int n)
+{
+  int c = connection;
+  struct pkt *buf = &buffer[c * WINDOWSIZE];  /* connection's window */
+  int i, k;
   struct pkt sendpkt;
-  /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
+  /* while not blocked waiting on ACK */
+  for (k = 0; k < n && windowcount[c] < WINDOWSIZE; k++) {
     if (TRACE > 1)
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = A_nextseqnum[c];
     sendpkt.acknum = NOTINUSE;
 
     for (i = 0; i < 20 ; i++ ) 
-    sendpkt.payload[i] = message.data[i];
+    sendpkt.payload[i] = messages[k].data[i];
     sendpkt.checksum = ComputeChecksum(sendpkt); 
 
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE; 
-    buffer[windowlast] = sendpkt;
-    windowcount++;
+    windowlast[c] = (windowlast[c] + 1) % WINDOWSIZE; 
+    buf[windowlast[c]] = sendpkt;
+    windowcount[c]++;
+    windowtotal++;
 
     /* send out packet */
     if (TRACE > 0)
       printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+    A_send(sendpkt);
 
-    if (windowcount == 1) {
+    if (windowcount[c] == 1) {
     starttimer(A, RTT);
   }
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;  
+    A_nextseqnum[c] = (A_nextseqnum[c] + 1) % SEQSPACE;  
   }
-  /* if blocked,  window is full */
-  else {
+  /* the rest are blocked, window is full */
+  for (i = k; i < n; i++) {
     if (TRACE > 0)
       printf("----A: New message arrives, send window is full\n");
     window_full++;
   }
+  return k;
+}
+
+/* called from layer 5 (application layer), passed the message to be sent to other side */
+void A_output(struct msg message)
+{
+  A_output_batch(&message, 1);
 }
 
 
@@ -112,39 +186,71 @@ void A_output(struct msg message)
 */
 void A_input(struct pkt packet)
 {
+  int c = connection;
+  struct pkt *buf = &buffer[c * WINDOWSIZE];  /* connection's window */
+  bool *ack = &acked[c * SEQSPACE];
+  int seq, first, d, bits;
   // Check if the received ACK packet is corrupted
   if (IsCorrupted(packet)) {
     if (TRACE > 0)
       printf("----A: corrupted ACK is received, do nothing!\n");
     return;
   }
+#if FEC
+  fec_feedback(packet);
+#endif
+
+  // Resend the packets B names as missing, even on a duplicate ACK
+  if (NAK && windowcount[c] > 0 && packet.acknum >= 0 && packet.acknum < SEQSPACE) {
+    first = buf[windowfirst[c]].seqnum;
+    for (d = 1; d < WINDOWSIZE; d++) {
+      bits = packet.payload[(d - 1) / NAKBITS] - '0';
+      if (bits < 0 || !(bits & (1 << ((d - 1) % NAKBITS))))
+        continue;
+      seq = (packet.acknum - d + SEQSPACE) % SEQSPACE;
+      if (InWindow(seq, first, windowcount[c]) && !ack[seq]) {
+        if (TRACE > 0)
+          printf("----A: NAK %d received, resending it\n", seq);
+        A_send(buf[(windowfirst[c] + (seq - first + SEQSPACE) % SEQSPACE) % WINDOWSIZE]);
+        packets_resent++;
+      }
+    }
+  }
 
   if (TRACE > 0)
     printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
+  total_ACKs_received++;
+
+  // Ignore ACKs that are not for a packet in the current window
+  if (windowcount[c] == 0 || !InWindow(packet.acknum, buf[windowfirst[c]].seqnum, windowcount[c])) {
+    if (TRACE > 0)
+      printf("----A: duplicate ACK received, do nothing!\n");
+    return;
+  }
 
   // If this ACK has not been received before
-  if (acked[packet.acknum] == false) {
-    acked[packet.acknum] = true;
+  if (ack[packet.acknum] == false) {
+    ack[packet.acknum] = true;
     new_ACKs++;
 
     if (TRACE > 0)
       printf("----A: ACK %d is not a duplicate\n", packet.acknum);
 
     // If this ACK matches the first packet in the current window
-    if (packet.acknum == buffer[windowfirst].seqnum) {
-      int i = 0;
+    if (packet.acknum == buf[windowfirst[c]].seqnum) {
       // Slide the window forward as long as the packets are acknowledged
-      while (i < windowcount && acked[buffer[windowfirst].seqnum]) {
-        windowfirst = (windowfirst + 1) % WINDOWSIZE;
-        i++;
+      while (windowcount[c] > 0 && ack[buf[windowfirst[c]].seqnum]) {
+        ack[buf[windowfirst[c]].seqnum] = false;
+        windowfirst[c] = (windowfirst[c] + 1) % WINDOWSIZE;
+        windowcount[c]--;
+        windowtotal--;
       }
-      windowcount -= i;
 
       // Stop the timer since the earliest unacked packet is now acked
       stoptimer(A);
 
       // If there are still unacked packets, restart the timer
-      if (windowcount > 0) {
+      if (windowcount[c] > 0) {
         starttimer(A, RTT);
       }
     }
@@ -159,14 +265,17 @@ void A_input(struct pkt packet)
 /* called when A's timer goes off */
 void A_timerinterrupt(void)
 {
+  int c = connection;
+  struct pkt *buf = &buffer[c * WINDOWSIZE];  /* connection's window */
+
   if (TRACE > 0)
     printf("----A: time out,resend packets!\n");
 
-  if (windowcount > 0) {
+  if (windowcount[c] > 0) {
     if (TRACE > 0)
-      printf ("---A: resending packet %d\n", buffer[windowfirst].seqnum);
+      printf ("---A: resending packet %d\n", buf[windowfirst[c]].seqnum);
     
-  tolayer3(A, buffer[windowfirst]);
+  A_send(buf[windowfirst[c]]);
   packets_resent++;
   starttimer(A,RTT);
     }
@@ -178,31 +287,97 @@ void A_timerinterrupt(void)
 /* entity A routines are called. You can use it to do any initialization */
 void A_init(void)
 {
+  int c;
+
+  buffer = state_alloc(buffer, nconnections * WINDOWSIZE, sizeof(struct pkt));
+  windowfirst = state_alloc(windowfirst, nconnections, sizeof(int));
+  windowlast = state_alloc(windowlast, nconnections, sizeof(int));
+  windowcount = state_alloc(windowcount, nconnections, sizeof(int));
+  A_nextseqnum = state_alloc(A_nextseqnum, nconnections, sizeof(int));
+  acked = state_alloc(acked, nconnections * SEQSPACE, sizeof(bool));
+
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.  
+  for (c=0; c<nconnections; c++) {
+    A_nextseqnum[c] = 0;  /* A starts with seq num 0, do not change this */
+    windowfirst[c] = 0;
+    windowlast[c] = -1;   /* windowlast is where the last packet sent is stored.  
 		     new packets are placed in winlast + 1 
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+    windowcount[c] = 0;
+  }
+  windowtotal = 0;
+#if FEC
+  fec_init(A, SEQSPACE);
+#endif
+}
+
+
+/* save A's state to a snapshot file, return 0 on error */
+int A_save(FILE *fp)
+{
+  int n = nconnections;
+
+  return fwrite(buffer, sizeof(struct pkt), n * WINDOWSIZE, fp) == (size_t)(n * WINDOWSIZE)
+      && fwrite(windowfirst, sizeof(int), n, fp) == (size_t)n
+      && fwrite(windowlast, sizeof(int), n, fp) == (size_t)n
+      && fwrite(windowcount, sizeof(int), n, fp) == (size_t)n
+      && fwrite(A_nextseqnum, sizeof(int), n, fp) == (size_t)n
+      && fwrite(acked, sizeof(bool), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+#if FEC
+      && fec_save(A, fp)
+#endif
+      ;
+}
+
+/* restore A's state from a snapshot file, after A_init(), return 0 on error */
+int A_restore(FILE *fp)
+{
+  int n = nconnections, c, ok;
+
+  ok = fread(buffer, sizeof(struct pkt), n * WINDOWSIZE, fp) == (size_t)(n * WINDOWSIZE)
+      && fread(windowfirst, sizeof(int), n, fp) == (size_t)n
+      && fread(windowlast, sizeof(int), n, fp) == (size_t)n
+      && fread(windowcount, sizeof(int), n, fp) == (size_t)n
+      && fread(A_nextseqnum, sizeof(int), n, fp) == (size_t)n
+      && fread(acked, sizeof(bool), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+#if FEC
+      && fec_restore(A, fp)
+#endif
+      ;
+  /* the running total is not in the snapshot: count it again */
+  windowtotal = 0;
+  for (c=0; c<n; c++)
+    windowtotal += windowcount[c];
+  return ok;
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
-static struct pkt recv_buffer[SEQSPACE]; /*buffer to store out-of-order packets*/
-static bool received[SEQSPACE];    /*track which seqnums have been received*/
+static int *expectedseqnum;     /* the sequence number expected next by the receiver */
+static struct pkt *recv_buffer; /* SEQSPACE packets per connection to store out-of-order packets */
+static bool *received;          /* track which seqnums have been received */
+#if NAK
+static long *nakclock;          /* packets received, per connection */
+static long *nakagain;          /* per seqnum, nakclock from which it may be asked for again */
+#endif
 
 
-/* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+/* a packet from A, after FEC if it is on */
+static void B_receive(struct pkt packet)
 {
+  int c = connection;
+  struct pkt *rbuf = &recv_buffer[c * SEQSPACE];  /* connection's receive window */
+  bool *rcvd = &received[c * SEQSPACE];
+#if NAK
+  long *again = &nakagain[c * SEQSPACE];
+  int gap = 0;                  /* the packet is buffered behind a gap */
+#endif
   struct pkt sendpkt;
-  int i;
+  struct msg deliver[SEQSPACE];
+  int i, j, n;
   int seq = packet.seqnum;
   int corrupted = IsCorrupted(packet);
 
@@ -214,32 +389,68 @@ void B_input(struct pkt packet)
   if (TRACE > 0)
     printf("----B: packet %d is correctly received, send ACK!\n", seq);
   packets_received++;
+#if NAK
+  nakclock[c]++;
+#endif
 
-  // If this packet hasn't been received before
-  if (received[seq] == false) {
-    received[seq] = true;
+  // If this packet is in the receive window and hasn't been received before
+  if (InWindow(seq, expectedseqnum[c], WINDOWSIZE) && rcvd[seq] == false) {
+    rcvd[seq] = true;
+#if NAK
+    gap = seq != expectedseqnum[c];
+#endif
 
     // Copy payload to buffer
-    int j;
     for (j = 0; j < 20; j++) {
-      recv_buffer[seq].payload[j] = packet.payload[j];
+      rbuf[seq].payload[j] = packet.payload[j];
     }
   }
       
+  /* pass every packet now in order up to layer 5 in one call */
+  n = 0;
   while (true) {
-    if (!received[expectedseqnum])
+    if (!rcvd[expectedseqnum[c]])
       break;
   
-    tolayer5(B, recv_buffer[expectedseqnum].payload);
-    received[expectedseqnum] = false;
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+    for (j = 0; j < 20; j++)
+      deliver[n].data[j] = rbuf[expectedseqnum[c]].payload[j];
+    n++;
+    rcvd[expectedseqnum[c]] = false;
+#if NAK
+    again[expectedseqnum[c]] = 0;
+#endif
+    expectedseqnum[c] = (expectedseqnum[c] + 1) % SEQSPACE;
     }
+  if (n > 0)
+    tolayer5_batch(B, deliver, n);
   
   sendpkt.seqnum = NOTINUSE;
   sendpkt.acknum = packet.seqnum;
 
   for ( i=0; i<20 ; i++ )    
     sendpkt.payload[i] = '0';   
+
+  /* a packet beyond a gap: name the packets still missing before it,
+     each at most once every NAKHOLDOFF packets received.  The one d
+     sequence numbers before the ACK is bit (d-1) % NAKBITS of payload
+     character (d-1) / NAKBITS, counted up from '0', so that the names
+     fit the payload for any sequence space. */
+#if NAK
+  if (gap)
+    for (i = expectedseqnum[c]; i != seq; i = (i + 1) % SEQSPACE)
+      if (!rcvd[i] && nakclock[c] >= again[i]) {
+        int d = (seq - i + SEQSPACE) % SEQSPACE;  /* behind the ACK */
+
+        if (TRACE > 0)
+          printf("----B: packet %d is missing, send NAK!\n", i);
+        sendpkt.payload[(d - 1) / NAKBITS] += 1 << ((d - 1) % NAKBITS);
+        again[i] = nakclock[c] + NAKHOLDOFF;
+      }
+#endif
+#if FEC
+  fec_stamp(&sendpkt);
+#endif
+
     /* computer checksum */
 
   sendpkt.checksum = ComputeChecksum(sendpkt); 
@@ -247,15 +458,97 @@ void B_input(struct pkt packet)
   tolayer3 (B, sendpkt);
 }
 
+/* called from layer 3, when a packet arrives for layer 4 at B*/
+void B_input(struct pkt packet)
+{
+#if FEC
+  fec_input(packet, B_receive);
+#else
+  B_receive(packet);
+#endif
+}
+
 
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
 void B_init(void)
 {
+  /* all connections expect seq num 0 and have nothing buffered */
+  expectedseqnum = state_alloc(expectedseqnum, nconnections, sizeof(int));
+  recv_buffer = state_alloc(recv_buffer, nconnections * SEQSPACE, sizeof(struct pkt));
+  received = state_alloc(received, nconnections * SEQSPACE, sizeof(bool));
+#if NAK
+  nakclock = state_alloc(nakclock, nconnections, sizeof(long));
+  nakagain = state_alloc(nakagain, nconnections * SEQSPACE, sizeof(long));
+#endif
+#if FEC
+  fec_init(B, SEQSPACE);
+#endif
+}
+
+
+/* save B's state to a snapshot file, return 0 on error */
+int B_save(FILE *fp)
+{
+  int n = nconnections;
+
+  return fwrite(expectedseqnum, sizeof(int), n, fp) == (size_t)n
+      && fwrite(recv_buffer, sizeof(struct pkt), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+      && fwrite(received, sizeof(bool), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+#if NAK
+      && fwrite(nakclock, sizeof(long), n, fp) == (size_t)n
+      && fwrite(nakagain, sizeof(long), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+#endif
+#if FEC
+      && fec_save(B, fp)
+#endif
+      ;
+}
 
-  expectedseqnum = 0;
+/* restore B's state from a snapshot file, after B_init(), return 0 on error */
+int B_restore(FILE *fp)
+{
+  int n = nconnections;
+
+  return fread(expectedseqnum, sizeof(int), n, fp) == (size_t)n
+      && fread(recv_buffer, sizeof(struct pkt), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+      && fread(received, sizeof(bool), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+#if NAK
+      && fread(nakclock, sizeof(long), n, fp) == (size_t)n
+      && fread(nakagain, sizeof(long), n * SEQSPACE, fp) == (size_t)(n * SEQSPACE)
+#endif
+#if FEC
+      && fec_restore(B, fp)
+#endif
+      ;
+}
 
+/* number of messages the current connection can take now */
+int A_windowopen(void)
+{
+  return WINDOWSIZE - windowcount[connection];
+}
+
+/* packets awaiting an ACK, summed over all connections */
+int A_windowcount(void)
+{
+  return windowtotal;
+}
+
+/* bytes of A and B state kept for each connection */
+size_t connection_state_size(void)
+{
+  size_t size = WINDOWSIZE * sizeof(struct pkt) + 4 * sizeof(int) + SEQSPACE * sizeof(bool)
+              + sizeof(int) + SEQSPACE * (sizeof(struct pkt) + sizeof(bool));
+
+#if NAK
+  size += sizeof(long) + SEQSPACE * sizeof(long);
+#endif
+#if FEC
+  size += fec_state_size();
+#endif
+  return size;
 }
 
 
@@ -3,8 +3,24 @@ extern void B_init(void);
 extern void A_input(struct pkt);
 extern void B_input(struct pkt);
 extern void A_output(struct msg);
+/* send as many of n messages as the window takes, return how many */
+extern int A_output_batch(const struct msg *, int n);
 extern void A_timerinterrupt(void);
 
+/* save/restore the entity's state to/from a snapshot, 0 on error */
+extern int A_save(FILE *);
+extern int A_restore(FILE *);
+extern int B_save(FILE *);
+extern int B_restore(FILE *);
+
+/* bytes of A and B state kept per connection */
+extern size_t connection_state_size(void);
+
+/* packets awaiting an ACK, summed over all connections */
+extern int A_windowcount(void);
+
+/* number of messages the current connection can take now */
+extern int A_windowopen(void);
 
 
 /* included for extension to bidirectional communication */
@@ -0,0 +1,43 @@
+#include <math.h>
+#include "stats.h"
+
+/****************************************************************************/
+/* Running statistics for the programs that run many simulations and        */
+/* report means with confidence intervals.                                  */
+/****************************************************************************/
+
+void running_add(struct running *r, double x)
+{
+  double d = x - r->mean;
+
+  r->n++;
+  r->mean += d / r->n;
+  r->m2 += d * (x - r->mean);
+}
+
+double running_sd(const struct running *r)
+{
+  return r->n > 1 ? sqrt(r->m2 / (r->n - 1)) : 0;
+}
+
+double running_ci95(const struct running *r)
+{
+  if (r->n < 2)
+    return INFINITY;
+  return t975(r->n - 1) * running_sd(r) / sqrt(r->n);
+}
+
+double t975(long df)
+{
+  static const double t[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+
+  if (df < 1)
+    return INFINITY;
+  if (df <= 30)
+    return t[df - 1];
+  return 1.960 + 2.4 / df;      /* within 0.002 of the table beyond 30 */
+}
@@ -0,0 +1,24 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* Mean and variance of a stream of samples, updated one sample at a
+   time with Welford's method so that long runs lose no precision. */
+struct running {
+  long n;
+  double mean;
+  double m2;              /* sum of squared differences from the mean */
+};
+
+extern void running_add(struct running *, double x);
+
+/* sample standard deviation, 0 with fewer than two samples */
+extern double running_sd(const struct running *);
+
+/* half width of the 95% confidence interval of the mean, from
+   Student's t; infinite with fewer than two samples */
+extern double running_ci95(const struct running *);
+
+/* 97.5th percentile of Student's t with df degrees of freedom */
+extern double t975(long df);
+
+#endif
@@ -0,0 +1,451 @@
+/* ******************************************************************
+   PROTOCOL PARAMETER TUNER
+
+   Looks for the WINDOWSIZE, RTT (A's timeout) and ACK policy of gbn.c
+   or sr.c that give the best goodput, or the lowest 99th percentile
+   delivery latency, on a given channel: loss, corruption, mean delay
+   and time between messages.  The ACK policy is SR's: plain selective
+   ACKs, or ACKs that also ask for missing packets (-DNAK=1).
+
+   - every configuration of the grid is built into an emulator binary of
+   its own, with the parameters given to the protocol with -D;
+   - the search is by successive halving: in each round every
+   configuration still in the race runs one short simulation, all with
+   the same seed, --jobs at a time, and the better half goes on to the
+   next round with twice as many messages;
+   - the last one left is run again with --reps seeds at the length of
+   the last round, and its mean is given with a 95% confidence interval.
+
+   Goodput is messages delivered per time unit.  A run that does not
+   finish within --time-limit seconds counts as the worst result.
+
+   Build with: gcc -O2 tune.c stats.c -lm
+   and run it in the directory holding the emulator's sources.
+   ********************************************************************* */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "stats.h"
+
+#define MAXLIST 32              /* values of a parameter in the grid */
+#define MAXCONFIGS (MAXLIST * MAXLIST * 2)
+#define NAKMAXWINDOW 115        /* largest window sr.c's ACKs can name the gaps of */
+#define OBJ_GOODPUT 0
+#define OBJ_P99     1
+
+struct config {
+  int window;
+  float rtt;
+  int nak;                      /* -1 for GBN, which has no choice */
+  char bin[64];                 /* emulator built with it */
+  double score;                 /* of the last round, larger is better */
+  int alive;                    /* still in the race */
+};
+
+/* a program run in the background */
+struct job {
+  char *argv[24];
+  char out[64];                 /* file its output goes to */
+  int in;                       /* 1 if it reads the settings file */
+  pid_t pid;
+};
+
+static struct config configs[MAXCONFIGS];
+static int nconfigs;
+static char dir[] = "/tmp/tuneXXXXXX";  /* builds, settings and outputs */
+static char settings[64];       /* answers to the emulator's prompts */
+
+/* settings */
+static const char *protocol = "gbn";
+static const char *srcdir = ".";
+static int windows[MAXLIST] = { 1, 2, 4, 6, 8, 12, 16, 24, 32 };
+static int nwindows = 9;
+static int windowsgiven;        /* with --windows */
+static float timeouts[MAXLIST] = { 8, 12, 16, 24, 32, 48 };
+static int ntimeouts = 6;
+static float lossprob = 0, corruptprob = 0, delay = 0, lambda = 10;
+static int objective = OBJ_GOODPUT;
+static int msgs = 500;          /* messages in the first round */
+static int jobs = 0;            /* simulations at a time, 0 for one per CPU */
+static int reps = 10;
+static unsigned int seed = 1;
+static int timelimit = 60;
+
+static void fail(const char *what)
+{
+  printf("%s failed: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+/* run n jobs, at most jobs at a time, and wait for all of them */
+static void runjobs(struct job *job, int n)
+{
+  int next = 0, running = 0, fd;
+  pid_t pid;
+
+  while (next < n || running > 0) {
+    if (next < n && running < jobs) {
+      pid = fork();
+      if (pid < 0)
+        fail("fork");
+      if (pid == 0) {
+        fd = open(job[next].in ? settings : "/dev/null", O_RDONLY);
+        if (fd < 0 || dup2(fd, 0) < 0)
+          _exit(127);
+        fd = open(job[next].out, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || dup2(fd, 1) < 0 || dup2(fd, 2) < 0)
+          _exit(127);
+        alarm(timelimit);         /* carried across exec */
+        execvp(job[next].argv[0], job[next].argv);
+        _exit(127);
+      }
+      job[next++].pid = pid;
+      running++;
+      continue;
+    }
+    if (wait(NULL) > 0)
+      running--;
+  }
+}
+
+/* compile every configuration */
+static void build(void)
+{
+  static char defs[MAXCONFIGS][3][32];
+  static char src[5][256];
+  struct job *job;
+  struct config *c;
+  int i, k;
+
+  job = calloc(nconfigs, sizeof(struct job));
+  if (job == NULL)
+    fail("calloc");
+  snprintf(src[0], sizeof src[0], "%s/emulator.c", srcdir);
+  snprintf(src[1], sizeof src[1], "%s/rng.c", srcdir);
+  snprintf(src[2], sizeof src[2], "%s/channel.c", srcdir);
+  snprintf(src[3], sizeof src[3], "%s/stats.c", srcdir);
+  snprintf(src[4], sizeof src[4], "%s/%s.c", srcdir, protocol);
+  for (i=0; i<nconfigs; i++) {
+    c = &configs[i];
+    snprintf(c->bin, sizeof c->bin, "%s/emu%d", dir, i);
+    snprintf(job[i].out, sizeof job[i].out, "%s/build%d", dir, i);
+    snprintf(defs[i][0], sizeof defs[i][0], "-DWINDOWSIZE=%d", c->window);
+    snprintf(defs[i][1], sizeof defs[i][1], "-DRTT=%g", c->rtt);
+    snprintf(defs[i][2], sizeof defs[i][2], "-DNAK=%d", c->nak > 0);
+    k = 0;
+    job[i].argv[k++] = "gcc";
+    job[i].argv[k++] = "-O2";
+    job[i].argv[k++] = "-o";
+    job[i].argv[k++] = c->bin;
+    job[i].argv[k++] = defs[i][0];
+    job[i].argv[k++] = defs[i][1];
+    job[i].argv[k++] = defs[i][2];
+    job[i].argv[k++] = src[0];
+    job[i].argv[k++] = src[1];
+    job[i].argv[k++] = src[2];
+    job[i].argv[k++] = src[3];
+    job[i].argv[k++] = src[4];
+    job[i].argv[k++] = "-lm";
+    job[i].argv[k] = NULL;
+  }
+  runjobs(job, nconfigs);
+  for (i=0; i<nconfigs; i++)
+    if (access(configs[i].bin, X_OK) != 0) {
+      printf("building configuration %d failed, see %s\n", i, job[i].out);
+      exit(EXIT_FAILURE);
+    }
+  free(job);
+}
+
+/* write the answers to the prompts for a run of n messages */
+static void writesettings(int n)
+{
+  FILE *fp = fopen(settings, "w");
+
+  if (fp == NULL)
+    fail(settings);
+  fprintf(fp, "%d\n%f\n%f\n", n, lossprob, corruptprob);
+  if (lossprob != 0 || corruptprob != 0)
+    fprintf(fp, "2\n");         /* both directions */
+  fprintf(fp, "%f\n0\n", lambda);
+  fclose(fp);
+}
+
+/* score of a finished run, larger is better; -INFINITY if it failed */
+static double score(const char *file)
+{
+  char line[512], *at;
+  float t = -1, p99 = -1;
+  int delivered = -1;
+  FILE *fp = fopen(file, "r");
+
+  if (fp == NULL)
+    return -INFINITY;
+  while (fgets(line, sizeof line, fp) != NULL) {
+    /* the prompts are not followed by newlines */
+    if ((at = strstr(line, "Simulator terminated at time")) != NULL)
+      sscanf(at, "Simulator terminated at time %f", &t);
+    sscanf(line, "number of messages delivered to application: %d", &delivered);
+    sscanf(line, "delivery latency over %*d messages: mean %*f, median %*f, 95%% %*f, 99%% %f", &p99);
+  }
+  fclose(fp);
+  if (objective == OBJ_P99)
+    return p99 >= 0 ? -p99 : -INFINITY;
+  return t > 0 && delivered >= 0 ? delivered / t : -INFINITY;
+}
+
+/* run the configurations in list for n messages with seed s */
+static void simulate(struct config **list, int count, int n, unsigned int s, double *result)
+{
+  static char seedarg[16], delayarg[16];
+  struct job *job;
+  int i, k;
+
+  job = calloc(count, sizeof(struct job));
+  if (job == NULL)
+    fail("calloc");
+  writesettings(n);
+  snprintf(seedarg, sizeof seedarg, "%u", s);
+  snprintf(delayarg, sizeof delayarg, "%g", delay);
+  for (i=0; i<count; i++) {
+    snprintf(job[i].out, sizeof job[i].out, "%s/run%d", dir, i);
+    job[i].in = 1;
+    k = 0;
+    job[i].argv[k++] = list[i]->bin;
+    job[i].argv[k++] = "--seed";
+    job[i].argv[k++] = seedarg;
+    if (delay > 0) {
+      job[i].argv[k++] = "--delay";
+      job[i].argv[k++] = delayarg;
+    }
+    if (objective == OBJ_P99)
+      job[i].argv[k++] = "--latency";
+    job[i].argv[k] = NULL;
+  }
+  runjobs(job, count);
+  for (i=0; i<count; i++)
+    result[i] = score(job[i].out);
+  free(job);
+}
+
+static int byscore(const void *a, const void *b)
+{
+  const struct config *p = *(struct config * const *)a, *q = *(struct config * const *)b;
+
+  return p->score < q->score ? 1 : p->score > q->score ? -1 : 0;
+}
+
+static void describe(const struct config *c)
+{
+  printf("WINDOWSIZE %d, RTT %g", c->window, c->rtt);
+  if (c->nak >= 0)
+    printf(", %s", c->nak ? "NAK" : "no NAK");
+}
+
+static double shown(double s)
+{
+  return objective == OBJ_P99 ? -s : s;
+}
+
+/* comma separated list of numbers, the count or 0 if it is not valid */
+static int parselist(const char *arg, float *f, int *d)
+{
+  char *end;
+  int n = 0;
+  double x;
+
+  while (n < MAXLIST) {
+    x = strtod(arg, &end);
+    if (end == arg || x <= 0)
+      return 0;
+    if (f != NULL)
+      f[n] = x;
+    else
+      d[n] = (int)x;
+    n++;
+    if (*end == 0)
+      return n;
+    if (*end != ',')
+      return 0;
+    arg = end + 1;
+  }
+  return 0;
+}
+
+static void cleanup(void)
+{
+  char path[128];
+  int i;
+
+  for (i=0; i<nconfigs; i++) {
+    unlink(configs[i].bin);
+    snprintf(path, sizeof path, "%s/build%d", dir, i);
+    unlink(path);
+    snprintf(path, sizeof path, "%s/run%d", dir, i);
+    unlink(path);
+  }
+  unlink(settings);
+  rmdir(dir);
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [options]\n", prog);
+  printf("  --protocol <p>       gbn (default) or sr\n");
+  printf("  --src <dir>          directory of the emulator's sources (default .)\n");
+  printf("  --loss <p>           packet loss probability of the channel\n");
+  printf("  --corrupt <p>        packet corruption probability\n");
+  printf("  --delay <t>          mean delay of the channel (default 5.5)\n");
+  printf("  --lambda <t>         average time between messages (default 10)\n");
+  printf("  --objective <o>      goodput (default) or p99 delivery latency\n");
+  printf("  --windows <list>     window sizes to try (default 1,2,4,6,8,12,16,24,32)\n");
+  printf("  --timeouts <list>    timeouts to try (default 8,12,16,24,32,48)\n");
+  printf("  --msgs <n>           messages in the first round (default 500)\n");
+  printf("  --jobs <n>           simulations at a time (default one per CPU)\n");
+  printf("  --reps <n>           runs of the winner for its interval (default 10)\n");
+  printf("  --seed <n>           seed of the first round (default 1)\n");
+  printf("  --time-limit <s>     seconds a run may take (default 60)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  static struct option options[] = {
+    {"protocol",  required_argument, NULL, 'p'},
+    {"src",       required_argument, NULL, 's'},
+    {"loss",      required_argument, NULL, 'l'},
+    {"corrupt",   required_argument, NULL, 'c'},
+    {"delay",     required_argument, NULL, 'D'},
+    {"lambda",    required_argument, NULL, 'm'},
+    {"objective", required_argument, NULL, 'o'},
+    {"windows",   required_argument, NULL, 'w'},
+    {"timeouts",  required_argument, NULL, 'T'},
+    {"msgs",      required_argument, NULL, 'n'},
+    {"jobs",      required_argument, NULL, 'j'},
+    {"reps",      required_argument, NULL, 'r'},
+    {"seed",      required_argument, NULL, 'S'},
+    {"time-limit", required_argument, NULL, 'L'},
+    {NULL, 0, NULL, 0}
+  };
+  struct config *list[MAXCONFIGS];
+  double result[MAXCONFIGS];
+  struct running final;
+  int c, i, j, k, count, n, round, nnak;
+
+  while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (c) {
+    case 'p': protocol = optarg; break;
+    case 's': srcdir = optarg; break;
+    case 'l': lossprob = atof(optarg); break;
+    case 'c': corruptprob = atof(optarg); break;
+    case 'D': delay = atof(optarg); break;
+    case 'm': lambda = atof(optarg); break;
+    case 'o':
+      if (strcmp(optarg, "goodput") == 0)
+        objective = OBJ_GOODPUT;
+      else if (strcmp(optarg, "p99") == 0)
+        objective = OBJ_P99;
+      else
+        usage(argv[0]);
+      break;
+    case 'w':
+      if ((nwindows = parselist(optarg, NULL, windows)) == 0)
+        usage(argv[0]);
+      windowsgiven = 1;
+      break;
+    case 'T':
+      if ((ntimeouts = parselist(optarg, timeouts, NULL)) == 0)
+        usage(argv[0]);
+      break;
+    case 'n': msgs = atoi(optarg); break;
+    case 'j': jobs = atoi(optarg); break;
+    case 'r': reps = atoi(optarg); break;
+    case 'S': seed = strtoul(optarg, NULL, 10); break;
+    case 'L': timelimit = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc || (strcmp(protocol, "gbn") != 0 && strcmp(protocol, "sr") != 0)
+      || msgs < 1 || jobs < 0 || reps < 2 || timelimit < 1 || lambda <= 0 || delay < 0)
+    usage(argv[0]);
+  if (jobs == 0)
+    jobs = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+  nnak = strcmp(protocol, "sr") == 0 ? 2 : 1;
+  for (i=0; i<nwindows; i++)
+    for (j=0; j<ntimeouts; j++)
+      for (k=0; k<nnak; k++) {
+        /* NAKs cannot be built for every window: leave such
+           configurations out of the default grid, and refuse them
+           when asked for */
+        if (nnak == 2 && k == 1 && windows[i] > NAKMAXWINDOW) {
+          if (windowsgiven) {
+            printf("sr.c cannot send NAKs with WINDOWSIZE %d (at most %d)\n",
+                   windows[i], NAKMAXWINDOW);
+            exit(EXIT_FAILURE);
+          }
+          continue;
+        }
+        configs[nconfigs].window = windows[i];
+        configs[nconfigs].rtt = timeouts[j];
+        configs[nconfigs].nak = nnak == 2 ? k : -1;
+        configs[nconfigs].alive = 1;
+        nconfigs++;
+      }
+  if (mkdtemp(dir) == NULL)
+    fail("mkdtemp");
+  snprintf(settings, sizeof settings, "%s/settings", dir);
+  atexit(cleanup);
+
+  printf("building %d configurations of %s\n", nconfigs, protocol);
+  fflush(stdout);
+  build();
+
+  /* successive halving */
+  count = nconfigs;
+  for (i=0; i<nconfigs; i++)
+    list[i] = &configs[i];
+  n = msgs;
+  for (round=1; count > 1; round++) {
+    simulate(list, count, n, seed + round - 1, result);
+    for (i=0; i<count; i++)
+      list[i]->score = result[i];
+    qsort(list, count, sizeof list[0], byscore);
+    printf("round %d: %d configurations, %d messages, best %s %f (",
+           round, count, n, objective == OBJ_P99 ? "p99 latency" : "goodput",
+           shown(list[0]->score));
+    describe(list[0]);
+    printf(")\n");
+    fflush(stdout);
+    for (i=(count+1)/2; i<count; i++)
+      list[i]->alive = 0;
+    count = (count + 1) / 2;
+    n *= 2;
+  }
+  n = n > msgs ? n / 2 : n;
+
+  /* the winner's interval, from seeds none of the rounds used */
+  memset(&final, 0, sizeof final);
+  for (i=0; i<reps; i++) {
+    simulate(list, 1, n, seed + 1000 + i, result);
+    if (result[0] == -INFINITY) {
+      printf("the winner did not finish a run of %d messages\n", n);
+      exit(EXIT_FAILURE);
+    }
+    running_add(&final, shown(result[0]));
+  }
+  printf("best: ");
+  describe(list[0]);
+  printf("\n%s %f, 95%% confidence interval %f to %f over %d runs of %d messages\n",
+         objective == OBJ_P99 ? "p99 latency" : "goodput",
+         final.mean, final.mean - running_ci95(&final), final.mean + running_ci95(&final),
+         reps, n);
+  return EXIT_SUCCESS;
+}
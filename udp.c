@@ -0,0 +1,507 @@
+/* ******************************************************************
+   UDP LOOPBACK TRANSPORT
+
+   Runs the A and B entities of gbn.c or sr.c as two processes that
+   exchange real UDP datagrams over 127.0.0.1, instead of the emulated
+   channel:
+
+   - each process waits in an epoll loop on its socket and on timerfds;
+   - starttimer()/stoptimer() arm and disarm a timerfd;
+   - packets handed to tolayer3() are queued and sent with one
+   sendmmsg() per pass of the loop, and arriving packets are read with
+   recvmmsg(), up to BATCH at a time;
+   - messages arrive from layer 5 at A on average every --lambda time
+   units, as in the emulator, where one time unit is --unit
+   microseconds of wall clock time;
+   - the sender can drop and corrupt packets with the probabilities and
+   corruption model of the emulator's channel (channel.c).  The delay
+   is whatever the loopback interface gives.
+
+   When A has sent all its messages and its timer has stopped it tells B
+   to finish, and the report gives the packets per second and the
+   system calls each side made.
+
+   Build with: gcc -O2 udp.c rng.c channel.c gbn.c -lm   (or sr.c)
+   ********************************************************************* */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "emulator.h"
+#include "gbn.h"
+#include "rng.h"
+#include "channel.h"
+
+#define BATCH 64                /* datagrams per sendmmsg()/recvmmsg() */
+#define FINRETRY 50000000L      /* ns between finish requests from A */
+
+int TRACE = 0;
+
+/* statistics updated by GBN */
+int window_full;
+int total_ACKs_received;
+int packets_resent;
+int new_ACKs;
+int packets_received;
+
+/* one connection between A and B */
+int nconnections = 1;
+int connection = 0;
+
+/* what each process did, kept in memory shared by both */
+struct udpstats {
+  long sent, lost, corrupted;   /* packets handed to tolayer3() */
+  long received;                /* packets read from the socket */
+  long sendcalls, recvcalls;    /* sendmmsg() and recvmmsg() calls */
+  long waits;                   /* epoll_wait() calls */
+  long timercalls;              /* timerfd_settime() calls */
+  long timeouts;                /* timer interrupts */
+  double utime, stime;          /* CPU seconds in user and system mode */
+  int packets_received;         /* B's protocol statistics */
+  int messages_delivered;
+};
+static struct udpstats *stats;  /* [A] and [B] */
+
+static int self;                /* entity run by this process */
+static int sock;                /* connected to the other entity */
+static int epfd;
+static int timerfd;             /* the protocol's timer */
+static int timeron;
+static int genfd;               /* next message from layer 5 (A only) */
+static struct timespec nextmsg; /* when it arrives */
+
+static struct rng rng;
+static struct channel channel;  /* loss and corruption of our packets */
+
+static struct pkt outq[BATCH];  /* packets waiting for sendmmsg() */
+static int noutq;
+
+static int nsim = 0;            /* number of messages from 5 to 4 so far */
+static int nsimmax = 1000;      /* number of msgs to generate, then stop */
+static float lossprob = 0;      /* probability that a packet is dropped  */
+static float corruptprob = 0;   /* probability that a packet is corrupted */
+static float lambda = 10;       /* average time between messages */
+static int direction = 2;       /* impaired directions: 0 A->B, 1 A<-B, 2 both */
+static long unit = 1000;        /* microseconds per time unit */
+static unsigned int seed = 9999;
+static int finished;
+
+static void fail(const char *what)
+{
+  printf("%s failed: %s\n", what, strerror(errno));
+  exit(EXIT_FAILURE);
+}
+
+static void addns(struct timespec *t, long ns)
+{
+  t->tv_sec += ns / 1000000000L;
+  t->tv_nsec += ns % 1000000000L;
+  if (t->tv_nsec >= 1000000000L) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000000000L;
+  }
+}
+
+/* timer expires after ns nanoseconds, or is disarmed if ns is 0 */
+static void settimer(int fd, long ns)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof its);
+  addns(&its.it_value, ns);
+  if (timerfd_settime(fd, 0, &its, NULL) < 0)
+    fail("timerfd_settime");
+  stats[self].timercalls++;
+}
+
+/********************** SENDING AND RECEIVING ***********************/
+
+static void flush(void)
+{
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, n, done = 0;
+
+  if (noutq == 0)
+    return;
+  memset(msgs, 0, sizeof msgs);
+  for (i=0; i<noutq; i++) {
+    iov[i].iov_base = &outq[i];
+    iov[i].iov_len = sizeof(struct pkt);
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  while (done < noutq) {
+    n = sendmmsg(sock, msgs + done, noutq - done, 0);
+    stats[self].sendcalls++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ECONNREFUSED)      /* the other side has gone */
+        break;
+      fail("sendmmsg");
+    }
+    done += n;
+  }
+  noutq = 0;
+}
+
+/* tell B to finish */
+static void sendfin(void)
+{
+  char c = 'F';
+
+  flush();
+  if (send(sock, &c, 1, 0) < 0 && errno != ECONNREFUSED)
+    fail("send");
+}
+
+/* read everything waiting on the socket */
+static void receive(void)
+{
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  struct pkt in[BATCH];
+  int i, n;
+
+  do {
+    memset(msgs, 0, sizeof msgs);
+    for (i=0; i<BATCH; i++) {
+      iov[i].iov_base = &in[i];
+      iov[i].iov_len = sizeof(struct pkt);
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    n = recvmmsg(sock, msgs, BATCH, MSG_DONTWAIT, NULL);
+    stats[self].recvcalls++;
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+          || errno == ECONNREFUSED)
+        return;
+      fail("recvmmsg");
+    }
+    for (i=0; i<n; i++) {
+      if (msgs[i].msg_len != sizeof(struct pkt)) {
+        if (self == B)            /* finish request from A */
+          finished = 1;
+        continue;
+      }
+      stats[self].received++;
+      if (self == A)
+        A_input(in[i]);
+      else
+        B_input(in[i]);
+    }
+  } while (n == BATCH);
+}
+
+/********************** Student-callable ROUTINES ***********************/
+
+void tolayer3(int AorB, struct pkt packet)
+{
+  int impaired = direction == 2 || direction == AorB;
+
+  stats[self].sent++;
+  if (impaired && channel_lost(&channel)) {
+    stats[self].lost++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being lost\n");
+    return;
+  }
+  if (impaired && channel_corrupt(&channel, &packet)) {
+    stats[self].corrupted++;
+    if (TRACE>0)
+      printf("          TOLAYER3: packet being corrupted\n");
+  }
+  if (noutq == BATCH)
+    flush();
+  outq[noutq++] = packet;
+}
+
+void tolayer5(int AorB, char datasent[20])
+{
+  stats[self].messages_delivered++;
+}
+
+void tolayer5_batch(int AorB, const struct msg *msgs, int n)
+{
+  stats[self].messages_delivered += n;
+}
+
+void starttimer(int AorB, double increment)
+{
+  if (timeron) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
+  timeron = 1;
+  settimer(timerfd, (long)(increment * unit * 1000));
+}
+
+void stoptimer(int AorB)
+{
+  if (!timeron) {
+    printf("Warning: unable to cancel your timer. It wasn't running.\n");
+    return;
+  }
+  timeron = 0;
+  settimer(timerfd, 0);
+}
+
+/********************** EVENT LOOP ***********************/
+
+/* time the next message arrives from layer 5 */
+static void advance_next_message(void)
+{
+  double x;
+
+  x = lambda * (rng_next(&rng)/(double)RNG_MAX) * 2;  /* uniform on [0,2*lambda] */
+  addns(&nextmsg, (long)(x * unit * 1000));
+}
+
+/* hand A every message whose arrival time has passed, then sleep until
+   the next one */
+static void generate_messages(void)
+{
+  struct itimerspec its;
+  struct timespec now;
+  struct msg msg2give;
+  int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  while (nsim < nsimmax && (nextmsg.tv_sec < now.tv_sec ||
+         (nextmsg.tv_sec == now.tv_sec && nextmsg.tv_nsec <= now.tv_nsec))) {
+    for (i=0; i<20; i++)
+      msg2give.data[i] = 97 + nsim % 26;
+    nsim++;
+    A_output(msg2give);
+    advance_next_message();
+  }
+  if (nsim < nsimmax) {
+    memset(&its, 0, sizeof its);
+    its.it_value = nextmsg;
+    if (timerfd_settime(genfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+      fail("timerfd_settime");
+    stats[self].timercalls++;
+  }
+}
+
+static void watch(int fd)
+{
+  struct epoll_event ev;
+
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    fail("epoll_ctl");
+}
+
+static void run(void)
+{
+  struct epoll_event evs[4];
+  uint64_t expirations;
+  int i, n, finwait = 0;
+  struct rusage ru;
+
+  epfd = epoll_create1(0);
+  timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (epfd < 0 || timerfd < 0)
+    fail("epoll/timerfd setup");
+  watch(sock);
+  watch(timerfd);
+  if (self == A) {
+    genfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (genfd < 0)
+      fail("timerfd_create");
+    watch(genfd);
+    A_init();
+    clock_gettime(CLOCK_MONOTONIC, &nextmsg);
+    advance_next_message();
+    generate_messages();
+  }
+  else
+    B_init();
+
+  while (!finished) {
+    n = epoll_wait(epfd, evs, 4, -1);
+    stats[self].waits++;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fail("epoll_wait");
+    }
+    for (i=0; i<n; i++) {
+      if (evs[i].data.fd == sock)
+        receive();
+      else if (read(evs[i].data.fd, &expirations, sizeof expirations) < 0)
+        continue;                 /* stopped since it expired */
+      else if (evs[i].data.fd == genfd && finwait) {
+        sendfin();                /* B has not finished yet, ask again */
+        settimer(genfd, FINRETRY);
+      }
+      else if (evs[i].data.fd == genfd)
+        generate_messages();
+      else if (timeron) {
+        timeron = 0;
+        stats[self].timeouts++;
+        if (self == A)
+          A_timerinterrupt();
+        else
+          B_timerinterrupt();
+      }
+    }
+    flush();
+    if (self == A && !finwait && nsim == nsimmax && !timeron) {
+      /* everything sent has been acknowledged */
+      finwait = 1;
+      sendfin();
+      settimer(genfd, FINRETRY);
+    }
+    if (self == A && finwait && waitpid(-1, NULL, WNOHANG) > 0)
+      finished = 1;
+  }
+
+  getrusage(RUSAGE_SELF, &ru);
+  stats[self].utime = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+  stats[self].stime = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+  if (self == B)
+    stats[B].packets_received = packets_received;
+}
+
+/* two UDP sockets on 127.0.0.1 connected to each other */
+static void makesockets(int fds[2])
+{
+  struct sockaddr_in addr[2];
+  socklen_t len;
+  int i, size = 1 << 20;
+
+  for (i=0; i<2; i++) {
+    fds[i] = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fds[i] < 0)
+      fail("socket");
+    setsockopt(fds[i], SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+    memset(&addr[i], 0, sizeof addr[i]);
+    addr[i].sin_family = AF_INET;
+    addr[i].sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fds[i], (struct sockaddr *)&addr[i], sizeof addr[i]) < 0)
+      fail("bind");
+    len = sizeof addr[i];
+    if (getsockname(fds[i], (struct sockaddr *)&addr[i], &len) < 0)
+      fail("getsockname");
+  }
+  for (i=0; i<2; i++)
+    if (connect(fds[i], (struct sockaddr *)&addr[1-i], sizeof addr[1-i]) < 0)
+      fail("connect");
+}
+
+static void printside(const char *name, struct udpstats *s)
+{
+  printf("%s: %ld packets sent (%ld lost, %ld corrupted), %ld received\n",
+         name, s->sent, s->lost, s->corrupted, s->received);
+  printf("%s: %ld sendmmsg (%.1f packets each), %ld recvmmsg (%.1f packets each)\n",
+         name, s->sendcalls, s->sendcalls ? (s->sent - s->lost) / (double)s->sendcalls : 0,
+         s->recvcalls, s->recvcalls ? s->received / (double)s->recvcalls : 0);
+  printf("%s: %ld epoll_wait, %ld timerfd_settime, %ld timeouts, cpu %.3f s user %.3f s system\n",
+         name, s->waits, s->timercalls, s->timeouts, s->utime, s->stime);
+}
+
+static void usage(const char *prog)
+{
+  printf("usage: %s [options]\n", prog);
+  printf("  --msgs <n>           number of messages to send (default 1000)\n");
+  printf("  --loss <p>           probability that the sender drops a packet\n");
+  printf("  --corrupt <p>        probability that the sender corrupts a packet\n");
+  printf("  --direction <d>      impaired directions: 0 A->B, 1 A<-B, 2 both (default 2)\n");
+  printf("  --lambda <t>         average time between messages (default 10)\n");
+  printf("  --unit <us>          microseconds per time unit (default 1000)\n");
+  printf("  --seed <n>           random number seed (default 9999)\n");
+  printf("  --trace <n>          TRACE level (default 0)\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+  static struct option options[] = {
+    {"msgs",      required_argument, NULL, 'n'},
+    {"loss",      required_argument, NULL, 'l'},
+    {"corrupt",   required_argument, NULL, 'c'},
+    {"direction", required_argument, NULL, 'd'},
+    {"lambda",    required_argument, NULL, 'm'},
+    {"unit",      required_argument, NULL, 'u'},
+    {"seed",      required_argument, NULL, 'S'},
+    {"trace",     required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0}
+  };
+  struct timeval start, end;
+  double elapsed;
+  int fds[2], c;
+  pid_t pid;
+
+  while ((c = getopt_long(argc, argv, "", options, NULL)) != -1) {
+    switch (c) {
+    case 'n': nsimmax = atoi(optarg); break;
+    case 'l': lossprob = atof(optarg); break;
+    case 'c': corruptprob = atof(optarg); break;
+    case 'd': direction = atoi(optarg); break;
+    case 'm': lambda = atof(optarg); break;
+    case 'u': unit = atol(optarg); break;
+    case 'S': seed = strtoul(optarg, NULL, 10); break;
+    case 't': TRACE = atoi(optarg); break;
+    default: usage(argv[0]);
+    }
+  }
+  if (optind < argc || nsimmax < 0 || lambda <= 0 || unit <= 0
+      || direction < 0 || direction > 2)
+    usage(argv[0]);
+
+  stats = mmap(NULL, 2 * sizeof(struct udpstats), PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (stats == MAP_FAILED)
+    fail("mmap");
+  memset(stats, 0, 2 * sizeof(struct udpstats));
+  makesockets(fds);
+  fflush(stdout);
+
+  gettimeofday(&start, NULL);
+  pid = fork();
+  if (pid < 0)
+    fail("fork");
+  self = pid == 0 ? B : A;
+  sock = fds[self];
+  close(fds[1-self]);
+  rng_seed(&rng, seed + self);
+  channel.lossprob = lossprob;
+  channel.corruptprob = corruptprob;
+  channel.rng = &rng;
+  run();
+  if (self == B)
+    exit(EXIT_SUCCESS);
+  gettimeofday(&end, NULL);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+
+  printf(" Transfer finished after %.3f s\n after attempting to send %d msgs from layer5\n", elapsed, nsim);
+  printf("number of messages dropped due to full window:  %d \n", window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
+  printf("number of packet resends by A:  %d \n", packets_resent);
+  printf("number of correct packets received at B:  %d \n", stats[B].packets_received);
+  printf("number of messages delivered to application:  %d \n", stats[B].messages_delivered);
+  printside("A", &stats[A]);
+  printside("B", &stats[B]);
+  printf("packets per second:  %.0f \n",
+         elapsed > 0 ? (stats[A].sent + stats[B].sent) / elapsed : 0);
+  return EXIT_SUCCESS;
+}